@@ -0,0 +1,318 @@
+import argparse
+import ctypes
+import hashlib
+import os
+import signal
+import subprocess
+import time
+from multiprocessing import shared_memory
+from pathlib import Path
+
+import numpy as np
+
+from sim_runner import ScenarioRunner
+
+# Observation of every slice, in the order written by SharedMemoryEnv in nr-multi-slice-sim.cc
+SLICES = ('voice', 'video', 'gaming')
+OBS_FIELDS = ('throughput_mbps', 'delay_ms', 'rx_packets', 'rlc_queue_bytes', 'prbs')
+OBS_DIM = len(SLICES) * len(OBS_FIELDS)
+ACT_DIM = len(SLICES)
+
+# Layout of the shared memory segment, as checked by SharedMemoryEnv
+MAGIC = 0x4e524550
+VERSION = 1
+HEADER_FIELDS = ('magic', 'version', 'num_envs', 'obs_dim', 'act_dim', 'pool_pid', 'closed')
+CONTROL_OFFSET = 64
+CONTROL_SIZE = 64
+# Control line of an environment, in uint64 words: action step, observation step,
+# simulated time (float64), done flag (uint32, low half of the word)
+ACTION_STEP, OBS_STEP, TIME_S, DONE = 0, 1, 2, 3
+
+
+
+def load_sync_library(source=Path(__file__).with_name('env_pool_sync.c')):
+    """
+    Build the step word helpers of env_pool_sync.c (atomics with release/acquire
+    ordering and futexes, from the platform headers) once per source version
+    into the user cache, and load them
+    """
+    digest = hashlib.sha256(source.read_bytes()).hexdigest()[:16]
+    cache_dir = Path(os.environ.get('XDG_CACHE_HOME', '~/.cache')).expanduser() / 'nr-multi-slice'
+    library = cache_dir / f"env_pool_sync-{digest}.so"
+    if not library.exists():
+        cache_dir.mkdir(parents=True, exist_ok=True)
+        compiler = os.environ.get('CC', 'cc')
+        tmp = library.with_name(f"{library.name}.{os.getpid()}.tmp")
+        proc = subprocess.run([compiler, '-O2', '-shared', '-fPIC', '-o', str(tmp), str(source)],
+                              capture_output=True, text=True)
+        if proc.returncode != 0:
+            raise ImportError(f"cannot build {source.name} with {compiler}: {proc.stderr.strip()}")
+        os.replace(tmp, library)
+
+    lib = ctypes.CDLL(str(library))
+    word, size = ctypes.c_void_p, ctypes.c_size_t
+    lib.env_store_release.argtypes = [word, ctypes.c_uint64]
+    lib.env_store_release32.argtypes = [word, ctypes.c_uint32]
+    lib.env_load_acquire.argtypes = [word]
+    lib.env_load_acquire.restype = ctypes.c_uint64
+    lib.env_behind.argtypes = [word, size, word, size, word, word]
+    lib.env_behind.restype = size
+    lib.env_futex_wait.argtypes = [word, ctypes.c_uint64, ctypes.c_double]
+    lib.env_futex_wake.argtypes = [word]
+    return lib
+
+
+# Both sides publish their step word with a release store and sleep on the
+# other's as a futex
+_sync = load_sync_library()
+
+
+def segment_layout(num_envs):
+    """Offsets of the observations and actions, and size of the segment"""
+    obs_offset = CONTROL_OFFSET + num_envs * CONTROL_SIZE
+    action_offset = (obs_offset + num_envs * OBS_DIM * 4 + 63) // 64 * 64
+    return obs_offset, action_offset, action_offset + num_envs * ACT_DIM * 4
+
+
+def observation_names():
+    """Name of every observation column, e.g. video_delay_ms"""
+    return [f"{slice_name}_{field}" for slice_name in SLICES for field in OBS_FIELDS]
+
+
+class EnvPool:
+    def __init__(self, runner, num_envs, overrides=None, first_seed=1, step_ms=10,
+                 auto_reset=True, spin_s=20e-6, timeout_s=600):
+        """
+        Pool of nr-multi-slice-sim environments stepped in lockstep, for batched
+        DRL rollouts
+
+        Every environment is a simulation process launched with --envShm. All of
+        them share one POSIX shared memory segment, which holds the observations
+        of the pool as one contiguous float32 [num_envs x OBS_DIM] array and the
+        actions as one int32 [num_envs x ACT_DIM] array of PRBs per slice
+        (negative: no cap). A step writes the actions, publishes the step number
+        in the control line of every environment and waits until all of them
+        have published their next observation: it spins for spin_s, then sleeps
+        on the step word of each environment still running as a futex. No
+        pipe, socket or pickling is involved. The step words are stored with
+        release and loaded with acquire ordering (env_pool_sync.c), so the
+        protocol holds on any Linux architecture.
+
+        Args:
+            runner: ScenarioRunner launching the simulations
+            num_envs: number of environments
+            overrides: CLI overrides of all the environments (dict), or one dict
+                per environment
+            first_seed: RngRun of the first episode of environment 0; environment
+                k starts at first_seed + k and adds num_envs at every new episode
+            step_ms: simulated time between two observations
+            auto_reset: start a new episode of an environment as soon as its
+                episode ends, within step()
+            spin_s: wall time spent polling the control lines before sleeping
+            timeout_s: wall time after which a silent environment is abandoned
+        """
+        self.runner = runner
+        self.num_envs = num_envs
+        if overrides is None or isinstance(overrides, dict):
+            overrides = [dict(overrides or {}) for _ in range(num_envs)]
+        if len(overrides) != num_envs:
+            raise ValueError(f"{len(overrides)} overrides for {num_envs} environments")
+        self.overrides = overrides
+        self.seeds = np.arange(first_seed, first_seed + num_envs)
+        self.step_ms = step_ms
+        self.auto_reset = auto_reset
+        self.spin_s = spin_s
+        self.timeout_s = timeout_s
+
+        obs_offset, action_offset, size = segment_layout(num_envs)
+        self._shm = shared_memory.SharedMemory(create=True, size=size)
+        buf = self._shm.buf
+        self._header = np.ndarray(len(HEADER_FIELDS), dtype=np.uint32, buffer=buf)
+        self._control = np.ndarray((num_envs, CONTROL_SIZE // 8), dtype=np.uint64, buffer=buf,
+                                   offset=CONTROL_OFFSET)
+        self.observations = np.ndarray((num_envs, OBS_DIM), dtype=np.float32, buffer=buf,
+                                       offset=obs_offset)
+        self.actions = np.ndarray((num_envs, ACT_DIM), dtype=np.int32, buffer=buf,
+                                  offset=action_offset)
+        self._header[:] = [MAGIC, VERSION, num_envs, OBS_DIM, ACT_DIM, os.getpid(), 0]
+
+        self.final_observations = np.zeros_like(self.observations)
+        self.episodes = np.zeros(num_envs, dtype=np.int64)
+        self._steps = np.zeros(num_envs, dtype=np.uint64)
+        self._procs = [None] * num_envs
+        self._exiting = []
+        self.sync_s = 0.0
+        self.num_steps = 0
+
+    @property
+    def times(self):
+        """Simulated time of the current observation of every environment"""
+        return self._control[:, TIME_S].view(np.float64)
+
+    @property
+    def dones(self):
+        """Environments whose current observation ends their episode"""
+        return self._control[:, DONE] != 0
+
+    def reset(self):
+        """
+        Start an episode in every environment
+
+        Returns:
+            the shared observation array, overwritten by the next step (copy it
+            to keep it); torch.from_numpy() wraps it without a copy
+        """
+        for k in range(self.num_envs):
+            self._launch(k)
+        self._wait(np.arange(self.num_envs))
+        return self.observations
+
+    def step(self, actions):
+        """
+        Apply one batch of actions and advance every environment by one step
+
+        Args:
+            actions: [num_envs x ACT_DIM] PRBs of every slice, negative for no cap
+
+        Returns:
+            (observations, dones). The observations are the shared array; an
+            environment that ended its episode is restarted when auto_reset is
+            set, its last observation is then in final_observations
+        """
+        start = time.perf_counter()
+        running = np.flatnonzero(~self.dones)
+        self.actions[running] = np.asarray(actions, dtype=np.int32)[running]
+        # Actions first, then the step numbers that release them
+        for k in running:
+            address = self._address(k, ACTION_STEP)
+            _sync.env_store_release(address, int(self._steps[k]))
+            _sync.env_futex_wake(address)
+        self._wait(running)
+        self.sync_s += time.perf_counter() - start
+        self.num_steps += 1
+
+        dones = self.dones.copy()
+        if self.auto_reset and dones.any():
+            ended = np.flatnonzero(dones)
+            self.final_observations[ended] = self.observations[ended]
+            for k in ended:
+                self.seeds[k] += self.num_envs
+                self._launch(k)
+            self._wait(ended)
+        return self.observations, dones
+
+    def close(self):
+        """Stop the environments and release the shared memory"""
+        _sync.env_store_release32(self._header.ctypes.data + 4 * HEADER_FIELDS.index('closed'), 1)
+        for k in range(self.num_envs):
+            _sync.env_futex_wake(self._address(k, ACTION_STEP))
+        for proc in self._procs + self._exiting:
+            if proc is None:
+                continue
+            try:
+                proc.wait(timeout=self.timeout_s)
+            except subprocess.TimeoutExpired:
+                self._kill(proc)
+        del self._header, self._control, self.observations, self.actions
+        try:
+            self._shm.close()
+        except BufferError:
+            pass  # observations still referenced by the caller, unmapped along with them
+        self._shm.unlink()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def _launch(self, k):
+        """Start a new episode of environment k in its own process"""
+        if self._procs[k] is not None:
+            # Its episode is over, let it write its results
+            self._exiting.append(self._procs[k])
+        self._control[k] = 0
+        self._steps[k] = 0
+        self.episodes[k] += 1
+
+        seed = int(self.seeds[k])
+        run_dir, _, _ = self.runner.prepare(self.overrides[k], f"env-{k}", seed)
+        overrides = dict(self.overrides[k], envShm=self._shm.name, envIndex=k,
+                         envStepMs=self.step_ms)
+        with open(run_dir / 'stdout.txt', 'w') as log:
+            self._procs[k] = subprocess.Popen(self.runner.command(overrides, run_dir, seed),
+                                              cwd=self.runner.ns3_dir, stdout=log,
+                                              stderr=subprocess.STDOUT, start_new_session=True)
+
+    def _address(self, k, word):
+        """Address of a word of the control line of environment k"""
+        return self._control.ctypes.data + int(k) * CONTROL_SIZE + word * 8
+
+    def _wait(self, envs):
+        """Wait until the environments envs have published their next observation"""
+        envs = np.asarray(envs, dtype=np.int64)
+        self._steps[envs] += 1
+        spin_end = time.perf_counter() + self.spin_s
+        while len(envs) and time.perf_counter() < spin_end:
+            envs = self._behind(envs)
+
+        deadline = time.monotonic() + self.timeout_s
+        for k in envs:
+            address = self._address(k, OBS_STEP)
+            while (seen := _sync.env_load_acquire(address)) < self._steps[k]:
+                if self._procs[k].poll() is not None or time.monotonic() > deadline:
+                    if _sync.env_load_acquire(address) < self._steps[k]:
+                        print(f"Error: environment {k} seed {self.seeds[k]} stopped responding")
+                        self._abandon(k)
+                    break
+                _sync.env_futex_wait(address, seen, 0.1)
+
+    def _behind(self, envs):
+        """Environments of envs that have not published their next observation yet"""
+        behind = np.empty_like(envs)
+        count = _sync.env_behind(self._address(0, OBS_STEP), CONTROL_SIZE // 8, envs.ctypes.data,
+                                 len(envs), self._steps.ctypes.data, behind.ctypes.data)
+        return behind[:count]
+
+    def _abandon(self, k):
+        """End the episode of an environment that exited or hung without a last observation"""
+        self._kill(self._procs[k])
+        self._control[k, DONE] = 1
+        self._control[k, OBS_STEP] = self._steps[k]
+
+    @staticmethod
+    def _kill(proc):
+        """Kill the ns3 wrapper of an environment together with the simulation it started"""
+        if proc.poll() is None:
+            os.killpg(proc.pid, signal.SIGKILL)
+        proc.wait()
+
+
+if __name__ == "__main__":
+    arg_parser = argparse.ArgumentParser(
+        description="Step a pool of nr-multi-slice-sim environments with random PRB actions "
+                    "and report the synchronisation cost")
+    arg_parser.add_argument('--envs', type=int, default=4)
+    arg_parser.add_argument('--steps', type=int, default=100)
+    arg_parser.add_argument('--step-ms', type=int, default=10)
+    arg_parser.add_argument('--prb-max', type=int, default=100)
+    arg_parser.add_argument('--ns3-dir', default='~/ns-3-dev')
+    arg_parser.add_argument('--config-file', default='config.txt')
+    arg_parser.add_argument('--work-dir', default='envs')
+    arg_parser.add_argument('--seed', type=int, default=1)
+    args = arg_parser.parse_args()
+
+    runner = ScenarioRunner(args.ns3_dir, config_file=args.config_file, work_dir=args.work_dir)
+    rng = np.random.default_rng(args.seed)
+    with EnvPool(runner, args.envs, first_seed=args.seed, step_ms=args.step_ms) as pool:
+        pool.reset()
+        start = time.perf_counter()
+        for _ in range(args.steps):
+            obs, dones = pool.step(rng.integers(1, args.prb_max + 1, size=(args.envs, ACT_DIM)))
+        elapsed = time.perf_counter() - start
+
+    print(f"{args.envs} environments, {args.steps} steps of {args.step_ms} ms: "
+          f"{1e3 * elapsed / args.steps:.3f} ms per batched step, "
+          f"{1e3 * pool.sync_s / max(pool.num_steps, 1):.3f} ms of it waiting for the slowest "
+          f"environment")
+    print(dict(zip(observation_names(), obs.mean(axis=0))))
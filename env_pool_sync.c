@@ -0,0 +1,62 @@
+/*
+ * Step words of the environment pool (env_pool.py), shared with SharedMemoryEnv
+ * in nr-multi-slice-sim.cc. A step word is published with a release store once
+ * the data it covers is written, and read with an acquire load before that data
+ * is read. Each side sleeps on the low half of the other's step word as a
+ * futex. Built by env_pool.py on first import, with the system C compiler.
+ */
+#include <linux/futex.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+static uint32_t* low_half(uint64_t* word)
+{
+    return (uint32_t*)word + (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__);
+}
+
+void env_store_release(uint64_t* word, uint64_t value)
+{
+    __atomic_store_n(word, value, __ATOMIC_RELEASE);
+}
+
+void env_store_release32(uint32_t* word, uint32_t value)
+{
+    __atomic_store_n(word, value, __ATOMIC_RELEASE);
+}
+
+uint64_t env_load_acquire(uint64_t* word)
+{
+    return __atomic_load_n(word, __ATOMIC_ACQUIRE);
+}
+
+/* Copy to behind the envs whose word (stride words apart) is below their target; returns the count */
+size_t env_behind(uint64_t* words, size_t stride, const int64_t* envs, size_t n,
+                  const uint64_t* targets, int64_t* behind)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        int64_t k = envs[i];
+        if (__atomic_load_n(words + k * stride, __ATOMIC_ACQUIRE) < targets[k])
+        {
+            behind[count++] = k;
+        }
+    }
+    return count;
+}
+
+/* Sleep while the word holds seen, at most timeout_s */
+void env_futex_wait(uint64_t* word, uint64_t seen, double timeout_s)
+{
+    struct timespec timeout = {(time_t)timeout_s, (long)((timeout_s - (time_t)timeout_s) * 1e9)};
+    syscall(SYS_futex, low_half(word), FUTEX_WAIT, (uint32_t)seen, &timeout, NULL, 0);
+}
+
+/* Wake the processes sleeping on the word */
+void env_futex_wake(uint64_t* word)
+{
+    syscall(SYS_futex, low_half(word), FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+}
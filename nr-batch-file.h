@@ -0,0 +1,89 @@
+/*
+ * Batch file of nr-multi-slice-sim (--batchFile): one scenario per line, turned
+ * into the command line of its run. Plain C++17, without ns-3, so that it can be
+ * checked on its own (test_batch.py).
+ */
+#ifndef NR_BATCH_FILE_H
+#define NR_BATCH_FILE_H
+
+#include <cstdint>
+#include <filesystem>
+#include <istream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/// One scenario of a batch file
+struct BatchRun
+{
+    uint32_t index;                //!< number of the run, counting from 0
+    std::string line;              //!< line of the batch file
+    std::filesystem::path runDir;  //!< output and working directory of the run
+    std::vector<std::string> args; //!< command line of the run, program name first
+};
+
+/**
+ * Read the scenarios of a batch file. Every non-empty line not starting with
+ * '#' is one scenario. Its outputDir (default run-<index>) becomes the run
+ * directory and is replaced by "--outputDir=.", since the run works in that
+ * directory; outputDir, configFile (default config.txt) and blerTableFile are
+ * made absolute, relative to batchDir. simTag defaults to "results".
+ */
+inline std::vector<BatchRun>
+ReadBatchFile(std::istream& batch, const std::string& program, const std::filesystem::path& batchDir)
+{
+    std::vector<BatchRun> runs;
+    for (std::string line; std::getline(batch, line);)
+    {
+        std::istringstream tokens(line);
+        std::vector<std::string> args{program};
+        for (std::string token; tokens >> token;)
+        {
+            args.push_back(token);
+        }
+        if (args.size() == 1 || args[1][0] == '#')
+        {
+            continue;
+        }
+
+        uint32_t index = runs.size();
+        std::filesystem::path runDir = batchDir / ("run-" + std::to_string(index));
+        std::string configFile = "config.txt";
+        bool hasSimTag = false;
+        for (auto it = args.begin() + 1; it != args.end();)
+        {
+            std::string key = it->substr(0, it->find('='));
+            std::string value = it->find('=') != std::string::npos
+                                    ? it->substr(it->find('=') + 1)
+                                    : std::string();
+            if (key == "--outputDir")
+            {
+                runDir = batchDir / value;
+                it = args.erase(it);
+                continue;
+            }
+            if (key == "--configFile")
+            {
+                configFile = value;
+                it = args.erase(it);
+                continue;
+            }
+            if (key == "--blerTableFile" && !value.empty())
+            {
+                *it = key + "=" + (batchDir / value).string();
+            }
+            hasSimTag = hasSimTag || key == "--simTag";
+            ++it;
+        }
+        args.push_back("--configFile=" + (batchDir / configFile).string());
+        args.push_back("--outputDir=.");
+        if (!hasSimTag)
+        {
+            args.push_back("--simTag=results");
+        }
+        runs.push_back({index, line, runDir, args});
+    }
+    return runs;
+}
+
+#endif // NR_BATCH_FILE_H
@@ -9,14 +9,3268 @@
 #include "ns3/mobility-module.h"
 #include "ns3/nr-module.h"
 #include "ns3/point-to-point-module.h"
+#include "ns3/spectrum-module.h"
+#include "ns3/traffic-control-module.h"
+
+#include "nr-batch-file.h"
+
+#include <arpa/inet.h>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <chrono>
 #include <cmath> 
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <filesystem>
+#include <limits>
+#include <linux/futex.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <set>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+using namespace ns3;
+
+NS_LOG_COMPONENT_DEFINE("3gppChannelNumsFdm");
+
+/**
+ * Periodically writes the FlowMonitor counters accumulated during the last
+ * interval, per flow and per slice, as CSV rows. The slice of a flow is found
+ * through its destination port.
+ *
+ * Only the cumulative counters seen at the previous report are kept per flow;
+ * the per-slice accumulators are cleared after each emit, so the reporter
+ * memory does not depend on the run length. With an empty filename nothing is
+ * written, and the reporter only feeds its slice callback.
+ */
+class FlowStatsReporter
+{
+  public:
+    /// Counter deltas of a flow or of a slice over one interval
+    struct Counters
+    {
+        uint64_t txBytes{0};
+        uint64_t rxBytes{0};
+        uint64_t txPackets{0};
+        uint64_t rxPackets{0};
+        uint64_t lostPackets{0};
+        Time delaySum;
+        Time jitterSum;
+    };
+
+    FlowStatsReporter(Ptr<FlowMonitor> monitor,
+                      Ptr<Ipv4FlowClassifier> classifier,
+                      const std::map<uint16_t, std::string>& sliceByPort,
+                      const std::string& filename)
+        : m_monitor(monitor),
+          m_classifier(classifier),
+          m_sliceByPort(sliceByPort)
+    {
+        if (filename.empty())
+        {
+            return;
+        }
+        m_outFile.open(filename.c_str(), std::ofstream::out | std::ofstream::trunc);
+        if (!m_outFile.is_open())
+        {
+            std::cerr << "Can't open file " << filename << std::endl;
+            return;
+        }
+        m_outFile.setf(std::ios_base::fixed);
+        m_outFile << "time(s),kind,id,slice,txBytes,rxBytes,txPackets,rxPackets,lostPackets,"
+                     "delaySum(s),jitterSum(s)\n";
+    }
+
+    /// Receives the per-slice deltas at the end of every report
+    using SliceCallback = std::function<void(const std::map<std::string, Counters>&)>;
+
+    void SetSliceCallback(SliceCallback cb)
+    {
+        m_sliceCallback = cb;
+    }
+
+    /**
+     * Schedule the first report at start + interval, and every interval after that.
+     */
+    void Start(Time start, Time interval)
+    {
+        m_interval = interval;
+        Simulator::Schedule(start + interval, &FlowStatsReporter::Report, this);
+    }
+
+  private:
+    void Report()
+    {
+        m_monitor->CheckForLostPackets();
+        const FlowMonitor::FlowStatsContainer& stats = m_monitor->GetFlowStats();
+
+        for (const auto& [flowId, flowStats] : stats)
+        {
+            Counters& last = m_lastByFlow[flowId];
+            Counters delta;
+            delta.txBytes = flowStats.txBytes - last.txBytes;
+            delta.rxBytes = flowStats.rxBytes - last.rxBytes;
+            delta.txPackets = flowStats.txPackets - last.txPackets;
+            delta.rxPackets = flowStats.rxPackets - last.rxPackets;
+            delta.lostPackets = flowStats.lostPackets - last.lostPackets;
+            delta.delaySum = flowStats.delaySum - last.delaySum;
+            delta.jitterSum = flowStats.jitterSum - last.jitterSum;
+
+            last.txBytes = flowStats.txBytes;
+            last.rxBytes = flowStats.rxBytes;
+            last.txPackets = flowStats.txPackets;
+            last.rxPackets = flowStats.rxPackets;
+            last.lostPackets = flowStats.lostPackets;
+            last.delaySum = flowStats.delaySum;
+            last.jitterSum = flowStats.jitterSum;
+
+            Ipv4FlowClassifier::FiveTuple t = m_classifier->FindFlow(flowId);
+            auto slice = m_sliceByPort.find(t.destinationPort);
+            std::string sliceName = slice != m_sliceByPort.end() ? slice->second : "other";
+
+            WriteRow("flow", std::to_string(flowId), sliceName, delta);
+
+            Counters& sliceDelta = m_sliceDelta[sliceName];
+            sliceDelta.txBytes += delta.txBytes;
+            sliceDelta.rxBytes += delta.rxBytes;
+            sliceDelta.txPackets += delta.txPackets;
+            sliceDelta.rxPackets += delta.rxPackets;
+            sliceDelta.lostPackets += delta.lostPackets;
+            sliceDelta.delaySum += delta.delaySum;
+            sliceDelta.jitterSum += delta.jitterSum;
+        }
+
+        for (const auto& [sliceName, sliceDelta] : m_sliceDelta)
+        {
+            WriteRow("slice", sliceName, sliceName, sliceDelta);
+        }
+        if (m_sliceCallback)
+        {
+            m_sliceCallback(m_sliceDelta);
+        }
+        m_sliceDelta.clear();
+        m_outFile.flush();
+
+        Simulator::Schedule(m_interval, &FlowStatsReporter::Report, this);
+    }
+
+    void WriteRow(const std::string& kind,
+                  const std::string& id,
+                  const std::string& slice,
+                  const Counters& c)
+    {
+        if (!m_outFile.is_open())
+        {
+            return;
+        }
+        m_outFile << Simulator::Now().GetSeconds() << "," << kind << "," << id << "," << slice
+                  << "," << c.txBytes << "," << c.rxBytes << "," << c.txPackets << ","
+                  << c.rxPackets << "," << c.lostPackets << "," << c.delaySum.GetSeconds() << ","
+                  << c.jitterSum.GetSeconds() << "\n";
+    }
+
+    Ptr<FlowMonitor> m_monitor;
+    Ptr<Ipv4FlowClassifier> m_classifier;
+    std::map<uint16_t, std::string> m_sliceByPort;
+    std::ofstream m_outFile;
+    Time m_interval;
+    std::map<FlowId, Counters> m_lastByFlow;        //!< cumulative counters at the last report
+    std::map<std::string, Counters> m_sliceDelta;   //!< per-slice deltas of the current report
+    SliceCallback m_sliceCallback;
+};
+
+/**
+ * Steady-state detection through batch means. The per-slice deltas of the
+ * FlowStatsReporter are grouped in batches of fixed length; each batch gives
+ * one throughput and one mean delay observation per slice. The first batch is
+ * discarded as warm-up. Once every slice has at least the minimum number of
+ * batches and the 95% confidence interval half-width of both metrics is below
+ * the requested fraction of their mean, the simulation is stopped.
+ *
+ * A batch in which a slice receives nothing gives no delay observation. Once
+ * a slice has the minimum number of such batches and still too few delay
+ * observations, its delay is left out of the test (with a warning), so that a
+ * slice whose packets are all lost does not keep the run going to simTimeMs.
+ */
+class ConvergenceMonitor
+{
+  public:
+    ConvergenceMonitor(Time batchLength, double relativePrecision, uint32_t minBatches)
+        : m_batchLength(batchLength),
+          m_relativePrecision(relativePrecision),
+          m_minBatches(minBatches)
+    {
+    }
+
+    /// Start collecting the first (warm-up) batch at the given time
+    void Start(Time start)
+    {
+        m_batchStart = start;
+    }
+
+    void AddSliceDeltas(const std::map<std::string, FlowStatsReporter::Counters>& deltas)
+    {
+        for (const auto& [slice, delta] : deltas)
+        {
+            Batch& batch = m_batch[slice];
+            batch.rxBytes += delta.rxBytes;
+            batch.rxPackets += delta.rxPackets;
+            batch.delaySum += delta.delaySum;
+        }
+
+        Time batchDuration = Simulator::Now() - m_batchStart;
+        if (batchDuration < m_batchLength)
+        {
+            return;
+        }
+
+        if (m_warmupDone)
+        {
+            for (const auto& [slice, batch] : m_batch)
+            {
+                SliceStats& stats = m_stats[slice];
+                stats.throughputMbps.Add(batch.rxBytes * 8.0 / batchDuration.GetSeconds() / 1e6);
+                if (batch.rxPackets > 0)
+                {
+                    stats.delayMs.Add(1000 * batch.delaySum.GetSeconds() / batch.rxPackets);
+                }
+                else
+                {
+                    stats.silentBatches++;
+                }
+            }
+        }
+        m_warmupDone = true;
+        m_batch.clear();
+        m_batchStart = Simulator::Now();
+
+        if (!m_converged && IsConverged())
+        {
+            m_converged = true;
+            Simulator::Stop();
+        }
+    }
+
+    bool HasConverged() const
+    {
+        return m_converged;
+    }
+
+    /// Write the per-slice batch means and confidence intervals to the results file
+    void WriteSummary(std::ostream& os) const
+    {
+        for (const auto& [slice, stats] : m_stats)
+        {
+            os << "  Slice " << slice << ": batches " << stats.throughputMbps.n
+               << ", throughput " << stats.throughputMbps.mean << " +/- "
+               << stats.throughputMbps.HalfWidth() << " Mbps, delay " << stats.delayMs.mean
+               << " +/- " << stats.delayMs.HalfWidth() << " ms";
+            if (stats.silentBatches > 0)
+            {
+                os << ", " << stats.silentBatches << " batches without packets"
+                   << (IsDelayExcluded(stats) ? " (delay not tested)" : "");
+            }
+            os << "\n";
+        }
+    }
+
+  private:
+    /// Running mean and variance (Welford) of the batch means of a metric
+    struct RunningStat
+    {
+        uint32_t n{0};
+        double mean{0.0};
+        double m2{0.0};
+
+        void Add(double x)
+        {
+            ++n;
+            double d = x - mean;
+            mean += d / n;
+            m2 += d * (x - mean);
+        }
+
+        /// Half-width of the 95% confidence interval of the mean
+        double HalfWidth() const
+        {
+            if (n < 2)
+            {
+                return std::numeric_limits<double>::infinity();
+            }
+            // Student t quantiles (0.975) for 1..30 degrees of freedom, as in replicate.py
+            static const double t975[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306,
+                                          2.262,  2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120,
+                                          2.110,  2.101, 2.093, 2.086, 2.080, 2.074, 2.069, 2.064,
+                                          2.060,  2.056, 2.052, 2.048, 2.045, 2.042};
+            uint32_t dof = n - 1;
+            double t = dof <= 30 ? t975[dof - 1] : 1.960;
+            return t * std::sqrt(m2 / dof / n);
+        }
+
+        bool IsPrecise(uint32_t minBatches, double relativePrecision) const
+        {
+            return n >= minBatches && HalfWidth() <= relativePrecision * std::abs(mean);
+        }
+    };
+
+    struct SliceStats
+    {
+        RunningStat throughputMbps;
+        RunningStat delayMs;
+        uint32_t silentBatches{0}; //!< batches without received packets
+        bool warned{false};
+    };
+
+    struct Batch
+    {
+        uint64_t rxBytes{0};
+        uint64_t rxPackets{0};
+        Time delaySum;
+    };
+
+    /// Too many batches without packets to ever test the delay of the slice
+    bool IsDelayExcluded(const SliceStats& stats) const
+    {
+        return stats.silentBatches >= m_minBatches && stats.delayMs.n < m_minBatches;
+    }
+
+    bool IsConverged()
+    {
+        if (m_stats.empty())
+        {
+            return false;
+        }
+        bool converged = true;
+        for (auto& [slice, stats] : m_stats)
+        {
+            bool delayExcluded = IsDelayExcluded(stats);
+            if (delayExcluded && !stats.warned)
+            {
+                std::cerr << "Slice " << slice << " received nothing in " << stats.silentBatches
+                          << " batches, its delay is left out of the convergence test"
+                          << std::endl;
+                stats.warned = true;
+            }
+            if (!stats.throughputMbps.IsPrecise(m_minBatches, m_relativePrecision) ||
+                (!delayExcluded && !stats.delayMs.IsPrecise(m_minBatches, m_relativePrecision)))
+            {
+                converged = false;
+            }
+        }
+        return converged;
+    }
+
+    Time m_batchLength;
+    double m_relativePrecision;
+    uint32_t m_minBatches;
+    Time m_batchStart;
+    bool m_warmupDone{false};
+    bool m_converged{false};
+    std::map<std::string, Batch> m_batch;
+    std::map<std::string, SliceStats> m_stats;
+};
+
+/**
+ * Per-slot PRB utilisation of every gNB BWP, from the NrGnbPhy "SlotDataStats"
+ * trace, written as fixed-width binary records. Each BWP carries one slice, so
+ * the bwpId of a record identifies its slice.
+ *
+ * In per-ms mode the slots of every (cell, BWP) falling in the same millisecond
+ * are summed into one record, which keeps the file size independent of the
+ * numerology. The file starts with a 16-byte header (magic "NRSLOT1", record
+ * size, mode) followed by host-endian SlotRecord structs.
+ */
+class SlotStatsTracer
+{
+  public:
+    /// One slot, or the sum of the slots of one millisecond
+    struct SlotRecord
+    {
+        int64_t timeNs;        //!< slot time, or start of the millisecond
+        uint16_t cellId;
+        uint16_t bwpId;
+        uint16_t slots;        //!< slots summed in this record
+        uint16_t activeUe;     //!< UEs scheduled, summed over the slots
+        uint32_t usedReg;      //!< allocated RB x symbols
+        uint32_t availableReg; //!< available RB x symbols
+        uint32_t usedSym;      //!< symbols with an allocation
+        uint32_t availableSym; //!< symbols available for data
+    };
+
+    static_assert(sizeof(SlotRecord) == 32, "SlotRecord must stay 32 bytes without padding");
+
+    SlotStatsTracer(const std::string& filename, bool perMs)
+        : m_perMs(perMs)
+    {
+        m_outFile.open(filename.c_str(), std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
+        if (!m_outFile.is_open())
+        {
+            std::cerr << "Can't open file " << filename << std::endl;
+            return;
+        }
+        char magic[8] = {'N', 'R', 'S', 'L', 'O', 'T', '1', '\0'};
+        uint32_t recordSize = sizeof(SlotRecord);
+        uint32_t mode = perMs ? 1 : 0;
+        m_outFile.write(magic, sizeof(magic));
+        m_outFile.write(reinterpret_cast<const char*>(&recordSize), sizeof(recordSize));
+        m_outFile.write(reinterpret_cast<const char*>(&mode), sizeof(mode));
+    }
+
+    ~SlotStatsTracer()
+    {
+        for (const auto& [key, record] : m_pending)
+        {
+            Write(record);
+        }
+    }
+
+    /// Connect to the SlotDataStats trace of every BWP of the gNBs
+    void Connect(const NetDeviceContainer& gnbNetDev, uint32_t numBwps)
+    {
+        for (uint32_t i = 0; i < gnbNetDev.GetN(); ++i)
+        {
+            for (uint32_t bwp = 0; bwp < numBwps; ++bwp)
+            {
+                NrHelper::GetGnbPhy(gnbNetDev.Get(i), bwp)
+                    ->TraceConnectWithoutContext("SlotDataStats",
+                                                 MakeCallback(&SlotStatsTracer::NotifySlot, this));
+            }
+        }
+    }
+
+  private:
+    void NotifySlot(const SfnSf& sfn,
+                    uint32_t activeUe,
+                    uint32_t usedReg,
+                    uint32_t usedSym,
+                    uint32_t availableRb,
+                    uint32_t availableSym,
+                    uint16_t bwpId,
+                    uint16_t cellId)
+    {
+        Time now = Simulator::Now();
+        SlotRecord slot{now.GetNanoSeconds(),
+                        cellId,
+                        bwpId,
+                        1,
+                        static_cast<uint16_t>(activeUe),
+                        usedReg,
+                        availableRb * availableSym,
+                        usedSym,
+                        availableSym};
+        if (!m_perMs)
+        {
+            Write(slot);
+            return;
+        }
+
+        int64_t msStartNs = now.GetNanoSeconds() / 1000000 * 1000000;
+        auto [it, inserted] = m_pending.try_emplace({cellId, bwpId}, slot);
+        SlotRecord& record = it->second;
+        if (!inserted && record.timeNs != msStartNs)
+        {
+            Write(record);
+            record = slot;
+            inserted = true;
+        }
+        if (inserted)
+        {
+            record.timeNs = msStartNs;
+            return;
+        }
+        record.slots += 1;
+        record.activeUe += slot.activeUe;
+        record.usedReg += slot.usedReg;
+        record.availableReg += slot.availableReg;
+        record.usedSym += slot.usedSym;
+        record.availableSym += slot.availableSym;
+    }
+
+    void Write(const SlotRecord& record)
+    {
+        if (m_outFile.is_open())
+        {
+            m_outFile.write(reinterpret_cast<const char*>(&record), sizeof(record));
+        }
+    }
+
+    bool m_perMs;
+    std::ofstream m_outFile;
+    std::map<std::pair<uint16_t, uint16_t>, SlotRecord> m_pending; //!< current ms per (cell, BWP)
+};
+
+/**
+ * Packet tag stamped by the UDP clients: transmission time and slice index.
+ */
+class LatencyTag : public Tag
+{
+  public:
+    LatencyTag() = default;
+
+    LatencyTag(Time txTime, uint8_t slice)
+        : m_txTimeNs(txTime.GetNanoSeconds()),
+          m_slice(slice)
+    {
+    }
+
+    static TypeId GetTypeId()
+    {
+        static TypeId tid =
+            TypeId("ns3::LatencyTag").SetParent<Tag>().SetGroupName("Nr").AddConstructor<
+                LatencyTag>();
+        return tid;
+    }
+
+    TypeId GetInstanceTypeId() const override
+    {
+        return GetTypeId();
+    }
+
+    uint32_t GetSerializedSize() const override
+    {
+        return sizeof(uint64_t) + sizeof(uint8_t);
+    }
+
+    void Serialize(TagBuffer i) const override
+    {
+        i.WriteU64(m_txTimeNs);
+        i.WriteU8(m_slice);
+    }
+
+    void Deserialize(TagBuffer i) override
+    {
+        m_txTimeNs = i.ReadU64();
+        m_slice = i.ReadU8();
+    }
+
+    void Print(std::ostream& os) const override
+    {
+        os << "txTime=" << m_txTimeNs << "ns slice=" << +m_slice;
+    }
+
+    Time GetTxTime() const
+    {
+        return NanoSeconds(m_txTimeNs);
+    }
+
+    uint8_t GetSlice() const
+    {
+        return m_slice;
+    }
+
+  private:
+    uint64_t m_txTimeNs{0};
+    uint8_t m_slice{0};
+};
+
+NS_OBJECT_ENSURE_REGISTERED(LatencyTag);
+
+/**
+ * Streaming per-slice decomposition of the packet latency, per packet.
+ *
+ * A receiving PHY decodes a transport block, hands its RLC PDUs to the RLC and
+ * the reassembled SDUs to the PDCP, which delivers them, all in one event. The
+ * traces of that chain give, for the packet being delivered:
+ *  - the start of the first transmission of its transport block and the air
+ *    time of the decoded one (symbols x symbol period), from RxPacketTrace;
+ *  - the time its last RLC PDU was built, from the RLC RxPDU delay;
+ *  - the time it entered the transmitting PDCP, from the PDCP RxPDU delay.
+ * A DL packet reaches its UDP server in the same event. A UL packet leaves the
+ * gNB towards the core network, its RAN times are kept under its packet UID
+ * until it reaches the server. There, with the send time from its LatencyTag,
+ * its latency splits exactly into core/transport (before the transmitting
+ * PDCP and after the receiving one), PDCP (until the RLC PDU is built),
+ * queueing and scheduling (until the first transmission), HARQ (until the
+ * decoded transmission) and air. MAC scheduling instants are not exported by
+ * the nr module, so queueing and scheduling are reported together. Only sums,
+ * counts and maxima are kept, so memory does not depend on the run length.
+ */
+class LatencyDecomposition
+{
+  public:
+    LatencyDecomposition(const std::vector<std::string>& slices,
+                         const std::map<uint8_t, std::string>& sliceByLcid,
+                         const std::map<uint16_t, std::string>& sliceByBwp)
+        : m_slices(slices),
+          m_sliceByLcid(sliceByLcid),
+          m_sliceByBwp(sliceByBwp)
+    {
+    }
+
+    /// Stamp the packets of the UDP clients of a slice
+    void ConnectClients(const ApplicationContainer& clients, const std::string& slice)
+    {
+        uint8_t index = std::find(m_slices.begin(), m_slices.end(), slice) - m_slices.begin();
+        for (uint32_t i = 0; i < clients.GetN(); ++i)
+        {
+            clients.Get(i)->TraceConnectWithoutContext(
+                "Tx",
+                MakeBoundCallback(&LatencyDecomposition::NotifyAppTx, index));
+        }
+    }
+
+    void ConnectServers(const ApplicationContainer& servers)
+    {
+        for (uint32_t i = 0; i < servers.GetN(); ++i)
+        {
+            servers.Get(i)->TraceConnectWithoutContext(
+                "Rx",
+                MakeCallback(&LatencyDecomposition::NotifyAppRx, this));
+        }
+    }
+
+    /// Symbol period of every gNB BWP, for the air time of the transport blocks
+    void SetSymbolPeriods(const NetDeviceContainer& gnbNetDev, uint32_t numBwps)
+    {
+        for (uint32_t i = 0; i < gnbNetDev.GetN(); ++i)
+        {
+            for (uint32_t bwp = 0; bwp < numBwps; ++bwp)
+            {
+                Ptr<NrGnbPhy> phy = NrHelper::GetGnbPhy(gnbNetDev.Get(i), bwp);
+                m_symbolPeriod[{phy->GetCellId(), bwp}] = phy->GetSymbolPeriod();
+            }
+        }
+    }
+
+    /**
+     * Connect the PDCP, RLC and PHY reception traces and the UL packets leaving
+     * the gNBs. The radio bearers only exist once the UEs are attached, so this
+     * is called at application start.
+     */
+    void ConnectRadioTraces()
+    {
+        Config::ConnectWithoutContext(
+            "/NodeList/*/DeviceList/*/$ns3::NrUeNetDevice/NrUeRrc/DataRadioBearerMap/*/"
+            "NrPdcp/RxPDU",
+            MakeCallback(&LatencyDecomposition::NotifyPdcpRx, this));
+        Config::ConnectWithoutContext(
+            "/NodeList/*/DeviceList/*/$ns3::NrGnbNetDevice/NrGnbRrc/UeMap/*/DataRadioBearerMap/*/"
+            "NrPdcp/RxPDU",
+            MakeCallback(&LatencyDecomposition::NotifyPdcpRx, this));
+        Config::ConnectWithoutContext(
+            "/NodeList/*/DeviceList/*/$ns3::NrUeNetDevice/NrUeRrc/DataRadioBearerMap/*/NrRlc/RxPDU",
+            MakeCallback(&LatencyDecomposition::NotifyRlcRx, this));
+        Config::ConnectWithoutContext(
+            "/NodeList/*/DeviceList/*/$ns3::NrGnbNetDevice/NrGnbRrc/UeMap/*/DataRadioBearerMap/*/"
+            "NrRlc/RxPDU",
+            MakeCallback(&LatencyDecomposition::NotifyRlcRx, this));
+        Config::ConnectWithoutContext("/NodeList/*/DeviceList/*/$ns3::NrUeNetDevice/"
+                                      "ComponentCarrierMapUe/*/NrUePhy/NrSpectrumPhyList/*/"
+                                      "RxPacketTraceUe",
+                                      MakeCallback(&LatencyDecomposition::NotifyTbRx, this));
+        Config::ConnectWithoutContext("/NodeList/*/DeviceList/*/$ns3::NrGnbNetDevice/"
+                                      "BandwidthPartMap/*/NrGnbPhy/NrSpectrumPhyList/*/"
+                                      "RxPacketTraceGnb",
+                                      MakeCallback(&LatencyDecomposition::NotifyTbRx, this));
+        Config::ConnectWithoutContext(
+            "/NodeList/*/ApplicationList/*/$ns3::NrEpcGnbApplication/RxFromGnb",
+            MakeCallback(&LatencyDecomposition::NotifyUlRanExit, this));
+    }
+
+    /// Write the per-slice breakdown as CSV, and a readable copy to the results file
+    void WriteSummary(const std::string& filename, std::ostream& os) const
+    {
+        std::ofstream csv(filename.c_str(), std::ofstream::out | std::ofstream::trunc);
+        csv.setf(std::ios_base::fixed);
+        csv << "slice,packets,e2e_ms,e2e_max_ms,decomposed,decomposed_e2e_ms,core_ms,pdcp_ms,"
+               "queue_sched_ms,harq_ms,air_ms,tbs,retx_tbs\n";
+        os << "\n  Latency decomposition (mean ms per packet):\n";
+        for (const std::string& slice : m_slices)
+        {
+            auto it = m_stats.find(slice);
+            if (it == m_stats.end())
+            {
+                continue;
+            }
+            const SliceLatency& s = it->second;
+            csv << slice << "," << s.endToEnd.n << "," << s.endToEnd.Mean() << ","
+                << s.endToEnd.max << "," << s.decomposed.n << "," << s.decomposed.Mean() << ","
+                << s.core.Mean() << "," << s.pdcp.Mean() << "," << s.queueSched.Mean() << ","
+                << s.harq.Mean() << "," << s.air.Mean() << "," << s.tbs << "," << s.retxTbs
+                << "\n";
+            os << "  Slice " << slice << ": e2e " << s.endToEnd.Mean() << " (max " << s.endToEnd.max
+               << ", " << s.endToEnd.n << " packets); " << s.decomposed.n << " decomposed packets: "
+               << s.decomposed.Mean() << " = core " << s.core.Mean() << " + pdcp "
+               << s.pdcp.Mean() << " + queue/sched " << s.queueSched.Mean() << " + harq "
+               << s.harq.Mean() << " + air " << s.air.Mean() << "\n";
+        }
+    }
+
+  private:
+    /// Streaming mean and maximum of a delay component, in ms
+    struct Component
+    {
+        uint64_t n{0};
+        double sum{0.0};
+        double max{0.0};
+
+        void Add(Time delay)
+        {
+            double ms = delay.GetSeconds() * 1000;
+            ++n;
+            sum += ms;
+            max = std::max(max, ms);
+        }
+
+        double Mean() const
+        {
+            return n > 0 ? sum / n : 0.0;
+        }
+    };
+
+    struct SliceLatency
+    {
+        Component endToEnd;   //!< every received packet
+        Component decomposed; //!< packets with RAN times, the sum of the components below
+        Component core;
+        Component pdcp;
+        Component queueSched;
+        Component harq;
+        Component air;
+        uint64_t tbs{0};
+        uint64_t retxTbs{0};
+    };
+
+    /// RAN times of a packet, seen by the receiving side
+    struct RanTimes
+    {
+        Time pdcpTx;  //!< entry into the transmitting PDCP
+        Time rlcTx;   //!< last RLC PDU built
+        Time firstTx; //!< start of the first transmission of its transport block
+        Time air;     //!< duration of the decoded transmission
+        Time exit;    //!< delivery by the receiving PDCP
+    };
+
+    /// Decoded transport block, RLC PDU and PDCP PDU of the current reception event
+    struct RxChain
+    {
+        Time at;
+        uint16_t rnti{0};
+        uint8_t lcid{0};
+        bool rlc{false};
+        bool pdcp{false};
+        RanTimes times;
+    };
+
+    static void NotifyAppTx(uint8_t slice, Ptr<const Packet> packet)
+    {
+        packet->AddPacketTag(LatencyTag(Simulator::Now(), slice));
+    }
+
+    void NotifyAppRx(Ptr<const Packet> packet)
+    {
+        LatencyTag tag;
+        if (!packet->PeekPacketTag(tag) || tag.GetSlice() >= m_slices.size())
+        {
+            return;
+        }
+        Time now = Simulator::Now();
+        SliceLatency& stats = m_stats[m_slices[tag.GetSlice()]];
+        stats.endToEnd.Add(now - tag.GetTxTime());
+
+        RanTimes ran;
+        auto ul = m_inCore.find(packet->GetUid());
+        if (ul != m_inCore.end())
+        {
+            ran = ul->second.second;
+            m_inCore.erase(ul);
+        }
+        else if (!TakeChain(tag.GetSlice(), ran))
+        {
+            return;
+        }
+        stats.decomposed.Add(now - tag.GetTxTime());
+        stats.core.Add((ran.pdcpTx - tag.GetTxTime()) + (now - ran.exit));
+        stats.pdcp.Add(ran.rlcTx - ran.pdcpTx);
+        stats.queueSched.Add(ran.firstTx - ran.rlcTx);
+        stats.harq.Add(ran.exit - ran.air - ran.firstTx);
+        stats.air.Add(ran.air);
+    }
+
+    /// UL packet leaving a gNB for the core network (a copy with the same UID)
+    void NotifyUlRanExit(Ptr<Packet> packet)
+    {
+        LatencyTag tag;
+        RanTimes ran;
+        if (!packet->PeekPacketTag(tag) || !TakeChain(tag.GetSlice(), ran))
+        {
+            return;
+        }
+        Time now = Simulator::Now();
+        m_inCore[packet->GetUid()] = {now, ran};
+        // Forget the packets lost in the core network
+        for (auto it = m_inCore.begin(); it != m_inCore.end();)
+        {
+            it = now - it->second.first > m_maxCoreAge ? m_inCore.erase(it) : std::next(it);
+        }
+    }
+
+    /// RAN times of the packet a PDCP of the slice delivered in this event, once
+    bool TakeChain(uint8_t slice, RanTimes& times)
+    {
+        if (!m_chain.pdcp || m_chain.at != Simulator::Now())
+        {
+            return false;
+        }
+        auto lcidSlice = m_sliceByLcid.find(m_chain.lcid);
+        if (lcidSlice == m_sliceByLcid.end() || slice >= m_slices.size() ||
+            lcidSlice->second != m_slices[slice])
+        {
+            return false;
+        }
+        m_chain.pdcp = false;
+        times = m_chain.times;
+        return true;
+    }
+
+    void NotifyPdcpRx(uint16_t rnti, uint8_t lcid, uint32_t size, uint64_t delayNs)
+    {
+        Time now = Simulator::Now();
+        if (m_chain.rlc && m_chain.at == now && m_chain.rnti == rnti && m_chain.lcid == lcid)
+        {
+            m_chain.times.pdcpTx = now - NanoSeconds(delayNs);
+            m_chain.times.exit = now;
+            m_chain.pdcp = true;
+        }
+    }
+
+    void NotifyRlcRx(uint16_t rnti, uint8_t lcid, uint32_t size, uint64_t delayNs)
+    {
+        Time now = Simulator::Now();
+        if (m_chain.at == now && m_chain.rnti == rnti)
+        {
+            m_chain.lcid = lcid;
+            m_chain.times.rlcTx = now - NanoSeconds(delayNs);
+            m_chain.rlc = true;
+            m_chain.pdcp = false;
+        }
+    }
+
+    void NotifyTbRx(RxPacketTraceParams params)
+    {
+        auto slice = m_sliceByBwp.find(params.m_bwpId);
+        auto period = m_symbolPeriod.find({static_cast<uint16_t>(params.m_cellId), params.m_bwpId});
+        if (slice == m_sliceByBwp.end() || period == m_symbolPeriod.end())
+        {
+            return;
+        }
+        SliceLatency& stats = m_stats[slice->second];
+        Time now = Simulator::Now();
+        Time air = period->second * params.m_numSym;
+
+        // Start of the failed first transmissions waiting for their retransmission, per HARQ
+        // entity
+        std::deque<Time>& pending =
+            m_firstTx[{static_cast<uint16_t>(params.m_cellId), params.m_rnti, params.m_bwpId}];
+        while (!pending.empty() && now - pending.front() > m_maxHarqAge)
+        {
+            pending.pop_front();
+        }
+        Time firstTx = now - air;
+        if (params.m_rv == 0 && params.m_corrupt)
+        {
+            pending.push_back(firstTx);
+            return;
+        }
+        if (params.m_corrupt)
+        {
+            return;
+        }
+        if (params.m_rv != 0)
+        {
+            if (pending.empty())
+            {
+                return;
+            }
+            firstTx = pending.front();
+            pending.pop_front();
+            stats.retxTbs++;
+        }
+        stats.tbs++;
+        m_chain = RxChain{};
+        m_chain.at = now;
+        m_chain.rnti = params.m_rnti;
+        m_chain.times.firstTx = firstTx;
+        m_chain.times.air = air;
+    }
+
+    std::vector<std::string> m_slices;
+    std::map<uint8_t, std::string> m_sliceByLcid;
+    std::map<uint16_t, std::string> m_sliceByBwp;
+    std::map<std::pair<uint16_t, uint16_t>, Time> m_symbolPeriod; //!< per (cell, BWP)
+    std::map<std::tuple<uint16_t, uint16_t, uint16_t>, std::deque<Time>> m_firstTx;
+    Time m_maxHarqAge{MilliSeconds(50)}; //!< failed TBs older than this are given up
+    RxChain m_chain;
+    std::map<uint64_t, std::pair<Time, RanTimes>> m_inCore; //!< UL packets by UID, with exit time
+    Time m_maxCoreAge{Seconds(1)}; //!< UL packets not received after this are given up
+    std::map<std::string, SliceLatency> m_stats;
+};
+
+/**
+ * Configured-grant uplink for one bearer.
+ *
+ * The nr module has no configured (grant-free) UL: a UE only gets UL resources
+ * after a scheduling request and a buffer status report. This emulates it at
+ * the gNB: every period, the scheduler of the bearer's BWP receives a BSR that
+ * adds one occasion's worth of data for the bearer's logical channel group to
+ * the buffers last reported by the UE, so the UE is granted UL resources
+ * without the SR/BSR exchange. Grants the UE has no data for are filled with
+ * padding. Only the first new UL grant of a UE after each occasion is counted
+ * as a configured grant; its retransmissions follow it through its HARQ
+ * process, and the bytes used in it are the RLC PDUs of the bearer decoded
+ * from those transport blocks.
+ */
+class ConfiguredGrantUplink
+{
+  public:
+    ConfiguredGrantUplink(Time period,
+                          uint32_t occasionBytes,
+                          uint8_t lcg,
+                          uint8_t lcid,
+                          uint16_t bwpId)
+        : m_period(period),
+          m_occasionBytes(occasionBytes),
+          m_lcg(lcg),
+          m_lcid(lcid),
+          m_bwpId(bwpId)
+    {
+    }
+
+    /**
+     * Look up the serving cell and RNTI of every UE and start the grant
+     * occasions. Called once the UEs are connected (at application start).
+     */
+    void Start(const NetDeviceContainer& ueNetDev)
+    {
+        std::set<Ptr<NrGnbNetDevice>> gnbs;
+        for (uint32_t i = 0; i < ueNetDev.GetN(); ++i)
+        {
+            Ptr<NrUeNetDevice> ue = DynamicCast<NrUeNetDevice>(ueNetDev.Get(i));
+            Ptr<NrGnbNetDevice> gnb = ue->GetTargetGnb();
+            uint16_t rnti = ue->GetRrc()->GetRnti();
+            m_ues[{gnb->GetCellId(), rnti}].scheduler = NrHelper::GetScheduler(gnb, m_bwpId);
+
+            std::ostringstream path;
+            path << "/NodeList/" << gnb->GetNode()->GetId() << "/DeviceList/" << gnb->GetIfIndex()
+                 << "/$ns3::NrGnbNetDevice/NrGnbRrc/UeMap/" << rnti
+                 << "/DataRadioBearerMap/*/NrRlc/RxPDU";
+            Config::ConnectWithoutContext(
+                path.str(),
+                MakeBoundCallback(&ConfiguredGrantUplink::NotifyRlcRx, this, gnb->GetCellId()));
+
+            if (gnbs.insert(gnb).second)
+            {
+                std::ostringstream gnbPath;
+                gnbPath << "/NodeList/" << gnb->GetNode()->GetId() << "/DeviceList/"
+                        << gnb->GetIfIndex() << "/$ns3::NrGnbNetDevice/BandwidthPartMap/*/";
+                // Real BSRs may arrive on any BWP
+                Config::ConnectWithoutContext(
+                    gnbPath.str() + "NrGnbMac/GnbMacRxedCtrlMsgsTrace",
+                    MakeBoundCallback(&ConfiguredGrantUplink::NotifyCtrlMsg,
+                                      this,
+                                      gnb->GetCellId()));
+                NrHelper::GetGnbMac(gnb, m_bwpId)
+                    ->TraceConnectWithoutContext(
+                        "UlScheduling",
+                        MakeBoundCallback(&ConfiguredGrantUplink::NotifyUlScheduling,
+                                          this,
+                                          gnb->GetCellId()));
+                Config::ConnectWithoutContext(
+                    gnbPath.str() + "NrGnbPhy/NrSpectrumPhyList/*/RxPacketTraceGnb",
+                    MakeCallback(&ConfiguredGrantUplink::NotifyTbRx, this));
+            }
+        }
+        Occasion();
+    }
+
+    void WriteSummary(std::ostream& os) const
+    {
+        os << "\n  Configured-grant UL (period " << m_period.GetMicroSeconds() << " us, "
+           << m_occasionBytes << " bytes per occasion):\n";
+        os << "  Occasions: " << m_occasions << " x " << m_ues.size() << " UEs\n";
+        os << "  Configured grants: " << m_grants << " (" << m_grantedBytes << " bytes)\n";
+        os << "  Other UL grants: " << m_otherGrants << "\n";
+        os << "  Used bytes: " << m_usedBytes << "\n";
+        os << "  Occupancy: "
+           << (m_grantedBytes > 0 ? 100.0 * m_usedBytes / m_grantedBytes : 0.0) << " %\n";
+        os << "  Wasted bytes: "
+           << (m_grantedBytes > m_usedBytes ? m_grantedBytes - m_usedBytes : 0) << "\n";
+    }
+
+  private:
+    struct Ue
+    {
+        Ptr<NrMacScheduler> scheduler;
+        std::vector<uint8_t> reported = std::vector<uint8_t>(4, 0); //!< last real BSR levels
+        bool occasionOpen{false};   //!< no configured grant yet since the last occasion
+        std::set<uint8_t> cgHarqIds; //!< HARQ processes carrying a configured grant
+    };
+
+    /// Slot and first symbol of a UL transport block of a UE
+    using TbKey = std::tuple<uint16_t, uint16_t, uint16_t, uint16_t, uint16_t, uint16_t>;
+
+    /// Report the last real buffers plus a full occasion for every UE, then
+    /// schedule the next occasion. The scheduler takes a BSR as the new state
+    /// of every LCG; the next real BSR of the UE corrects it
+    void Occasion()
+    {
+        for (auto& [key, ue] : m_ues)
+        {
+            MacCeElement bsr;
+            bsr.m_rnti = key.second;
+            bsr.m_macCeType = MacCeElement::BSR;
+            bsr.m_macCeValue.m_bufferStatus = ue.reported;
+            bsr.m_macCeValue.m_bufferStatus.at(m_lcg) = NrMacShortBsrCe::FromBytesToLevel(
+                NrMacShortBsrCe::FromLevelToBytes(ue.reported.at(m_lcg)) + m_occasionBytes);
+
+            NrMacSchedSapProvider::SchedUlMacCtrlInfoReqParameters params;
+            params.m_macCeList.push_back(bsr);
+            ue.scheduler->DoSchedUlMacCtrlInfoReq(params);
+            ue.occasionOpen = true;
+        }
+        m_occasions++;
+        Simulator::Schedule(m_period, &ConfiguredGrantUplink::Occasion, this);
+    }
+
+    static void NotifyCtrlMsg(ConfiguredGrantUplink* self,
+                              uint16_t cellId,
+                              SfnSf sfn,
+                              uint16_t nodeId,
+                              uint16_t rnti,
+                              uint8_t bwpId,
+                              Ptr<const NrControlMessage> msg)
+    {
+        if (msg->GetMessageType() != NrControlMessage::BSR)
+        {
+            return;
+        }
+        auto ue = self->m_ues.find({cellId, rnti});
+        Ptr<NrBsrMessage> bsr = DynamicCast<NrBsrMessage>(ConstCast<NrControlMessage>(msg));
+        if (ue != self->m_ues.end() && bsr)
+        {
+            std::vector<uint8_t> levels = bsr->GetBsr().m_macCeValue.m_bufferStatus;
+            levels.resize(4, 0);
+            ue->second.reported = levels;
+        }
+    }
+
+    static void NotifyUlScheduling(ConfiguredGrantUplink* self,
+                                   uint16_t cellId,
+                                   NrSchedulingCallbackInfo info)
+    {
+        auto it = self->m_ues.find({cellId, info.m_rnti});
+        if (it == self->m_ues.end())
+        {
+            return;
+        }
+        Ue& ue = it->second;
+        if (info.m_rv == 0)
+        {
+            ue.cgHarqIds.erase(info.m_harqId);
+            if (!ue.occasionOpen)
+            {
+                self->m_otherGrants++;
+                return;
+            }
+            ue.occasionOpen = false;
+            ue.cgHarqIds.insert(info.m_harqId);
+            self->m_grants++;
+            self->m_grantedBytes += info.m_tbSize;
+        }
+        else if (!ue.cgHarqIds.count(info.m_harqId))
+        {
+            return;
+        }
+        self->m_cgTbs.insert({cellId,
+                              info.m_rnti,
+                              info.m_frameNum,
+                              info.m_subframeNum,
+                              info.m_slotNum,
+                              info.m_symStart});
+    }
+
+    /// A decoded configured-grant TB is handed to the RLC in the same event
+    void NotifyTbRx(RxPacketTraceParams params)
+    {
+        auto tb = m_cgTbs.find({static_cast<uint16_t>(params.m_cellId),
+                                params.m_rnti,
+                                static_cast<uint16_t>(params.m_frameNum),
+                                params.m_subframeNum,
+                                params.m_slotNum,
+                                params.m_symStart});
+        if (tb == m_cgTbs.end())
+        {
+            return;
+        }
+        m_cgTbs.erase(tb);
+        if (!params.m_corrupt)
+        {
+            m_decoded = {Simulator::Now(), static_cast<uint16_t>(params.m_cellId), params.m_rnti};
+        }
+    }
+
+    static void NotifyRlcRx(ConfiguredGrantUplink* self,
+                            uint16_t cellId,
+                            uint16_t rnti,
+                            uint8_t lcid,
+                            uint32_t size,
+                            uint64_t delayNs)
+    {
+        auto [at, tbCell, tbRnti] = self->m_decoded;
+        if (lcid == self->m_lcid && at == Simulator::Now() && tbCell == cellId && tbRnti == rnti)
+        {
+            self->m_usedBytes += size;
+        }
+    }
+
+    Time m_period;
+    uint32_t m_occasionBytes;
+    uint8_t m_lcg;
+    uint8_t m_lcid;
+    uint16_t m_bwpId;
+    std::map<std::pair<uint16_t, uint16_t>, Ue> m_ues; //!< per (cell, RNTI)
+    std::set<TbKey> m_cgTbs;                           //!< configured-grant TBs not yet received
+    std::tuple<Time, uint16_t, uint16_t> m_decoded;    //!< last decoded one: (time, cell, RNTI)
+    uint64_t m_occasions{0};
+    uint64_t m_grants{0};       //!< new UL transmissions granted in an occasion
+    uint64_t m_grantedBytes{0};
+    uint64_t m_otherGrants{0};  //!< new UL transmissions granted on real BSRs
+    uint64_t m_usedBytes{0};    //!< RLC PDU bytes of the bearer in configured grants
+};
+
+/**
+ * The mMTC devices of one cell as a single traffic and access-load generator.
+ *
+ * Every device reports once per report interval. The superposition of the N
+ * devices is drawn directly as a Poisson process of rate N / interval, each
+ * arrival belonging to a uniformly chosen device; a device that still has a
+ * report pending merges the new one into it. Pending devices contend at the
+ * next RACH occasion by picking one of the contention preambles at random
+ * (slotted ALOHA): a preamble picked by a single device succeeds, the others
+ * collide and back off a uniform number of occasions, up to maxAttempts
+ * attempts. Every successful device sends its payload as one UDP packet from
+ * the relay UE of the cell, so the data load goes through the real UL stack.
+ * A device costs 8 bytes, whatever the number of devices.
+ */
+class AggregatedMmtcSource
+{
+  public:
+    struct Parameters
+    {
+        uint32_t devices{10000};
+        Time reportInterval{Seconds(10)};
+        uint32_t packetSize{32};
+        Time rachPeriod{MilliSeconds(5)};
+        uint16_t preambles{54};
+        uint8_t maxAttempts{10};
+        uint16_t backoffOccasions{4};
+    };
+
+    AggregatedMmtcSource(const Parameters& params, uint16_t cellId)
+        : m_params(params),
+          m_cellId(cellId),
+          m_devices(params.devices),
+          m_occasions(params.backoffOccasions + 1),
+          m_preambleUse(params.preambles, 0)
+    {
+        m_interArrival = CreateObject<ExponentialRandomVariable>();
+        m_uniform = CreateObject<UniformRandomVariable>();
+    }
+
+    int64_t AssignStreams(int64_t stream)
+    {
+        m_interArrival->SetStream(stream);
+        m_uniform->SetStream(stream + 1);
+        return 2;
+    }
+
+    /// Start the arrivals and the RACH occasions; reports go to remote from relay
+    void Start(Ptr<Node> relay, const Address& remote)
+    {
+        m_socket = Socket::CreateSocket(relay, UdpSocketFactory::GetTypeId());
+        m_socket->Bind();
+        m_socket->Connect(remote);
+        ScheduleArrival();
+        Simulator::Schedule(m_params.rachPeriod, &AggregatedMmtcSource::RachOccasion, this);
+    }
+
+    void WriteSummary(std::ostream& os) const
+    {
+        os << "  mMTC cell " << m_cellId << ": " << m_devices.size() << " devices, " << m_arrivals
+           << " reports (" << m_merged << " merged), " << m_attempts << " RACH attempts, "
+           << m_collisions << " collisions, " << m_delivered << " delivered, " << m_failed
+           << " access failures, mean access delay "
+           << (m_delivered > 0 ? m_accessDelayMs / m_delivered : 0.0) << " ms\n";
+    }
+
+  private:
+    /// Per-device state
+    struct Device
+    {
+        uint32_t arrivalMs{0}; //!< arrival time of the pending report
+        uint8_t attempts{0};
+        bool pending{false};
+    };
+
+    void ScheduleArrival()
+    {
+        double meanS = m_params.reportInterval.GetSeconds() / m_devices.size();
+        Simulator::Schedule(Seconds(m_interArrival->GetValue(meanS, 0)),
+                            &AggregatedMmtcSource::Arrival,
+                            this);
+    }
+
+    void Arrival()
+    {
+        uint32_t id = m_uniform->GetInteger(0, m_devices.size() - 1);
+        Device& device = m_devices[id];
+        m_arrivals++;
+        if (device.pending)
+        {
+            m_merged++;
+        }
+        else
+        {
+            device.pending = true;
+            device.arrivalMs = Simulator::Now().GetMilliSeconds();
+            m_occasions[(m_occasion + 1) % m_occasions.size()].push_back(id);
+        }
+        ScheduleArrival();
+    }
+
+    void RachOccasion()
+    {
+        m_occasion++;
+        std::vector<uint32_t> contenders;
+        contenders.swap(m_occasions[m_occasion % m_occasions.size()]);
+
+        std::vector<uint16_t> choice(contenders.size());
+        std::fill(m_preambleUse.begin(), m_preambleUse.end(), 0);
+        for (size_t i = 0; i < contenders.size(); ++i)
+        {
+            choice[i] = m_uniform->GetInteger(0, m_params.preambles - 1);
+            m_preambleUse[choice[i]]++;
+        }
+
+        for (size_t i = 0; i < contenders.size(); ++i)
+        {
+            Device& device = m_devices[contenders[i]];
+            device.attempts++;
+            m_attempts++;
+            if (m_preambleUse[choice[i]] == 1)
+            {
+                m_delivered++;
+                m_accessDelayMs += Simulator::Now().GetMilliSeconds() - device.arrivalMs;
+                device = Device();
+                Send();
+                continue;
+            }
+            m_collisions++;
+            if (device.attempts >= m_params.maxAttempts)
+            {
+                m_failed++;
+                device = Device();
+                continue;
+            }
+            uint32_t backoff = m_uniform->GetInteger(1, m_params.backoffOccasions);
+            m_occasions[(m_occasion + backoff) % m_occasions.size()].push_back(contenders[i]);
+        }
+
+        Simulator::Schedule(m_params.rachPeriod, &AggregatedMmtcSource::RachOccasion, this);
+    }
+
+    void Send()
+    {
+        SeqTsHeader seqTs;
+        seqTs.SetSeq(m_seq++);
+        uint32_t headerSize = seqTs.GetSerializedSize();
+        Ptr<Packet> packet =
+            Create<Packet>(m_params.packetSize - std::min(m_params.packetSize, headerSize));
+        packet->AddHeader(seqTs);
+        m_socket->Send(packet);
+    }
+
+    Parameters m_params;
+    uint16_t m_cellId;
+    std::vector<Device> m_devices;
+    std::vector<std::vector<uint32_t>> m_occasions; //!< contenders of the next occasions (ring)
+    uint64_t m_occasion{0};
+    std::vector<uint16_t> m_preambleUse;
+    Ptr<ExponentialRandomVariable> m_interArrival;
+    Ptr<UniformRandomVariable> m_uniform;
+    Ptr<Socket> m_socket;
+    uint32_t m_seq{0};
+
+    uint64_t m_arrivals{0};
+    uint64_t m_merged{0};
+    uint64_t m_attempts{0};
+    uint64_t m_collisions{0};
+    uint64_t m_delivered{0};
+    uint64_t m_failed{0};
+    double m_accessDelayMs{0.0};
+};
+
+/**
+ * Transmit-only spectrum PHY: puts a PSD on a spectrum channel for a given
+ * duration. It has no device, is never a receiver and has no protocol stack,
+ * so it costs one channel transmission per call. Its 1x1 isotropic array
+ * keeps it usable with the 3GPP spectrum propagation model. The NR PHYs
+ * receive its signal as interference.
+ */
+class InterferenceTransmitter : public SpectrumPhy
+{
+  public:
+    static TypeId GetTypeId()
+    {
+        static TypeId tid = TypeId("ns3::InterferenceTransmitter")
+                                .SetParent<SpectrumPhy>()
+                                .SetGroupName("Nr")
+                                .AddConstructor<InterferenceTransmitter>();
+        return tid;
+    }
+
+    InterferenceTransmitter()
+    {
+        m_antenna = CreateObject<UniformPlanarArray>();
+        m_antenna->SetAttribute("NumRows", UintegerValue(1));
+        m_antenna->SetAttribute("NumColumns", UintegerValue(1));
+        PhasedArrayModel::ComplexVector beamforming(1);
+        beamforming[0] = 1.0;
+        m_antenna->SetBeamformingVector(beamforming);
+    }
+
+    void SetDevice(Ptr<NetDevice> d) override
+    {
+    }
+
+    Ptr<NetDevice> GetDevice() const override
+    {
+        return nullptr;
+    }
+
+    void SetMobility(Ptr<MobilityModel> m) override
+    {
+        m_mobility = m;
+    }
+
+    Ptr<MobilityModel> GetMobility() const override
+    {
+        return m_mobility;
+    }
+
+    void SetChannel(Ptr<SpectrumChannel> c) override
+    {
+        m_channel = c;
+    }
+
+    Ptr<const SpectrumModel> GetRxSpectrumModel() const override
+    {
+        return nullptr;
+    }
+
+    Ptr<Object> GetAntenna() const override
+    {
+        return m_antenna;
+    }
+
+    void StartRx(Ptr<SpectrumSignalParameters> params) override
+    {
+    }
+
+    /// W/Hz of every RB when the gNB PHY transmits on all of them
+    static double GetFullLoadRbPsd(Ptr<NrPhy> phy)
+    {
+        Ptr<const SpectrumModel> model = phy->GetSpectrumModel();
+        double rbBandwidthHz = model->Begin()->fh - model->Begin()->fl;
+        return std::pow(10.0, (phy->GetTxPower() - 30) / 10) / phy->GetRbNum() / rbBandwidthHz;
+    }
+
+    void Transmit(Ptr<SpectrumValue> psd, Time duration)
+    {
+        Ptr<SpectrumSignalParameters> params = Create<SpectrumSignalParameters>();
+        params->duration = duration;
+        params->psd = psd;
+        params->txPhy = this;
+        params->txAntenna = m_antenna;
+        m_channel->StartTx(params);
+    }
+
+  private:
+    Ptr<MobilityModel> m_mobility;
+    Ptr<SpectrumChannel> m_channel;
+    Ptr<UniformPlanarArray> m_antenna;
+};
+
+NS_OBJECT_ENSURE_REGISTERED(InterferenceTransmitter);
+
+/**
+ * Notched RBG masks of the schedulers that several features restrict at
+ * once. Each feature sets the mask of its own layer, and the scheduler gets
+ * the AND of the layers: an RBG is usable only if no layer notches it. An
+ * empty layer notches nothing.
+ */
+class NotchedRbgMasks
+{
+  public:
+    enum Layer
+    {
+        BACKGROUND,  //!< RBGs occupied by a fluid background load
+        SLICE_LIMIT, //!< RBGs above the PRB budget of a slice
+        NUM_LAYERS
+    };
+
+    void SetDl(Ptr<NrMacSchedulerNs3> scheduler, Layer layer, const std::vector<uint8_t>& mask)
+    {
+        Set(scheduler, true, layer, mask);
+    }
+
+    void SetUl(Ptr<NrMacSchedulerNs3> scheduler, Layer layer, const std::vector<uint8_t>& mask)
+    {
+        Set(scheduler, false, layer, mask);
+    }
+
+  private:
+    void Set(Ptr<NrMacSchedulerNs3> scheduler,
+             bool dl,
+             Layer layer,
+             const std::vector<uint8_t>& mask)
+    {
+        auto& layers = m_masks[{PeekPointer(scheduler), dl}];
+        layers[layer] = mask;
+        std::vector<uint8_t> combined;
+        for (const auto& layerMask : layers)
+        {
+            if (combined.empty())
+            {
+                combined = layerMask;
+                continue;
+            }
+            for (size_t i = 0; i < std::min(combined.size(), layerMask.size()); ++i)
+            {
+                combined[i] &= layerMask[i];
+            }
+        }
+        if (dl)
+        {
+            scheduler->SetDlNotchedRbgMask(combined);
+        }
+        else
+        {
+            scheduler->SetUlNotchedRbgMask(combined);
+        }
+    }
+
+    std::map<std::pair<const NrMacSchedulerNs3*, bool>,
+             std::array<std::vector<uint8_t>, NUM_LAYERS>>
+        m_masks;
+};
+
+/**
+ * Background DL load of a cell, as a fluid instead of packets.
+ *
+ * The offered rate of the background UEs fills a fluid backlog; every period
+ * the backlog is served on as many RBGs as it needs at the given spectral
+ * efficiency. Those RBGs are notched out of the scheduler of the BWP (BACKGROUND
+ * layer of the NotchedRbgMasks), so the packet-level UEs only get the rest, and
+ * an InterferenceTransmitter at the gNB radiates the gNB PSD on them, so the
+ * neighbouring cells see the load as interference. The cost is one event per
+ * period, whatever the background population.
+ */
+class FluidBackgroundLoad
+{
+  public:
+    FluidBackgroundLoad(Ptr<NetDevice> gnbDev,
+                        uint16_t bwpId,
+                        double rateMbps,
+                        double efficiency,
+                        Time period,
+                        NotchedRbgMasks& masks)
+        : m_rateBps(rateMbps * 1e6),
+          m_period(period),
+          m_masks(masks)
+    {
+        Ptr<NrGnbPhy> phy = NrHelper::GetGnbPhy(gnbDev, bwpId);
+        m_cellId = phy->GetCellId();
+        m_scheduler = DynamicCast<NrMacSchedulerNs3>(NrHelper::GetScheduler(gnbDev, bwpId));
+        m_rbPerRbg = NrHelper::GetGnbMac(gnbDev, bwpId)->GetNumRbPerRbg();
+        m_numRb = phy->GetRbNum();
+        m_numRbg = m_numRb / m_rbPerRbg;
+
+        m_spectrumModel = phy->GetSpectrumModel();
+        m_psdPerRb = InterferenceTransmitter::GetFullLoadRbPsd(phy);
+        double rbBandwidthHz = m_spectrumModel->Begin()->fh - m_spectrumModel->Begin()->fl;
+        m_bitsPerRbg = efficiency * rbBandwidthHz * m_rbPerRbg * period.GetSeconds();
+
+        m_transmitter = CreateObject<InterferenceTransmitter>();
+        m_transmitter->SetMobility(gnbDev->GetNode()->GetObject<MobilityModel>());
+        m_transmitter->SetChannel(phy->GetSpectrumPhy()->GetSpectrumChannel());
+    }
+
+    void Start()
+    {
+        Update();
+    }
+
+    void WriteSummary(std::ostream& os) const
+    {
+        double elapsedS = m_periods * m_period.GetSeconds();
+        os << "  Fluid background cell " << m_cellId << ": offered " << m_rateBps / 1e6
+           << " Mbps, served " << (m_periods > 0 ? m_servedBits / elapsedS / 1e6 : 0.0)
+           << " Mbps, mean RBG occupancy "
+           << (m_periods > 0 ? 100.0 * m_occupiedRbgs / (m_periods * m_numRbg) : 0.0)
+           << " %, backlog " << m_backlogBits / 8 << " bytes\n";
+    }
+
+  private:
+    void Update()
+    {
+        m_backlogBits += m_rateBps * m_period.GetSeconds();
+        uint32_t rbgs = std::min<uint32_t>(m_numRbg, std::ceil(m_backlogBits / m_bitsPerRbg));
+        double served = std::min(m_backlogBits, rbgs * m_bitsPerRbg);
+        m_backlogBits -= served;
+
+        // The background occupies the top RBGs of the BWP
+        std::vector<uint8_t> mask(m_numRbg, 1);
+        std::fill(mask.end() - rbgs, mask.end(), 0);
+        m_masks.SetDl(m_scheduler, NotchedRbgMasks::BACKGROUND, mask);
+        if (rbgs > 0)
+        {
+            Ptr<SpectrumValue> psd = Create<SpectrumValue>(m_spectrumModel);
+            for (uint32_t rb = (m_numRbg - rbgs) * m_rbPerRbg; rb < m_numRbg * m_rbPerRbg; ++rb)
+            {
+                (*psd)[rb] = m_psdPerRb;
+            }
+            m_transmitter->Transmit(psd, m_period);
+        }
+
+        m_periods++;
+        m_occupiedRbgs += rbgs;
+        m_servedBits += served;
+        Simulator::Schedule(m_period, &FluidBackgroundLoad::Update, this);
+    }
+
+    double m_rateBps;
+    Time m_period;
+    NotchedRbgMasks& m_masks;
+    uint16_t m_cellId;
+    Ptr<NrMacSchedulerNs3> m_scheduler;
+    uint32_t m_rbPerRbg;
+    uint32_t m_numRb;
+    uint32_t m_numRbg;
+    Ptr<const SpectrumModel> m_spectrumModel;
+    double m_psdPerRb;   //!< W/Hz of an occupied RB
+    double m_bitsPerRbg; //!< bits served by one RBG in one period
+    Ptr<InterferenceTransmitter> m_transmitter;
+
+    double m_backlogBits{0.0};
+    uint64_t m_periods{0};
+    uint64_t m_occupiedRbgs{0};
+    double m_servedBits{0.0};
+};
+
+/**
+ * Interference-only gNB: a node with one InterferenceTransmitter per DL BWP,
+ * and no device, UEs, MAC/RLC stack or scheduling events. Its UL is a second
+ * node, a UE of the cell, with one InterferenceTransmitter per UL BWP. Every
+ * period each RBG is busy with probability equal to the load, independently of
+ * the others, and carries the full-load PSD of the reference gNB (DL) or UE
+ * (UL) on that BWP. The mean interference therefore scales with the load, and
+ * the instantaneous one varies from period to period like a scheduled cell.
+ */
+class InterferenceOnlyGnb
+{
+  public:
+    InterferenceOnlyGnb(Ptr<Node> node, double load, Time period)
+        : m_node(node),
+          m_load(load),
+          m_period(period)
+    {
+        m_uniform = CreateObject<UniformRandomVariable>();
+    }
+
+    /// Transmit on the DL BWP bwpId, with the spectrum and power of referenceGnb on it
+    void AddBwp(Ptr<NetDevice> referenceGnb, uint16_t bwpId)
+    {
+        AddTransmitter(m_node,
+                       NrHelper::GetGnbPhy(referenceGnb, bwpId),
+                       NrHelper::GetGnbMac(referenceGnb, bwpId)->GetNumRbPerRbg());
+    }
+
+    /// Transmit on the UL BWP bwpId of referenceGnb from uePosition, with the
+    /// spectrum and power of referenceUe on it
+    void AddUlBwp(Ptr<NetDevice> referenceGnb,
+                  Ptr<NetDevice> referenceUe,
+                  uint16_t bwpId,
+                  Vector uePosition)
+    {
+        if (!m_ueNode)
+        {
+            m_ueNode = CreateObject<Node>();
+            Ptr<MobilityModel> mobility = CreateObject<ConstantPositionMobilityModel>();
+            mobility->SetPosition(uePosition);
+            m_ueNode->AggregateObject(mobility);
+        }
+        AddTransmitter(m_ueNode,
+                       NrHelper::GetUePhy(referenceUe, bwpId),
+                       NrHelper::GetGnbMac(referenceGnb, bwpId)->GetNumRbPerRbg());
+    }
+
+    int64_t AssignStreams(int64_t stream)
+    {
+        m_uniform->SetStream(stream);
+        return 1;
+    }
+
+    void Start()
+    {
+        Update();
+    }
+
+    /// Fraction of the RBGs that were busy, over all periods and BWPs
+    double GetOccupancy() const
+    {
+        return m_rbgs > 0 ? static_cast<double>(m_busyRbgs) / m_rbgs : 0.0;
+    }
+
+  private:
+    struct Bwp
+    {
+        Ptr<InterferenceTransmitter> transmitter;
+        Ptr<const SpectrumModel> spectrumModel;
+        uint32_t numRb;
+        uint32_t rbPerRbg;
+        double psdPerRb;
+    };
+
+    void AddTransmitter(Ptr<Node> node, Ptr<NrPhy> phy, uint32_t rbPerRbg)
+    {
+        Bwp bwp;
+        bwp.transmitter = CreateObject<InterferenceTransmitter>();
+        bwp.transmitter->SetMobility(node->GetObject<MobilityModel>());
+        bwp.transmitter->SetChannel(phy->GetSpectrumPhy()->GetSpectrumChannel());
+        bwp.spectrumModel = phy->GetSpectrumModel();
+        bwp.numRb = phy->GetRbNum();
+        bwp.rbPerRbg = rbPerRbg;
+        bwp.psdPerRb = InterferenceTransmitter::GetFullLoadRbPsd(phy);
+        m_bwps.push_back(bwp);
+    }
+
+    void Update()
+    {
+        for (const Bwp& bwp : m_bwps)
+        {
+            Ptr<SpectrumValue> psd = Create<SpectrumValue>(bwp.spectrumModel);
+            uint32_t busy = 0;
+            uint32_t numRbg = bwp.numRb / bwp.rbPerRbg;
+            for (uint32_t rbg = 0; rbg < numRbg; ++rbg)
+            {
+                if (m_uniform->GetValue() < m_load)
+                {
+                    busy++;
+                    for (uint32_t rb = rbg * bwp.rbPerRbg; rb < (rbg + 1) * bwp.rbPerRbg; ++rb)
+                    {
+                        (*psd)[rb] = bwp.psdPerRb;
+                    }
+                }
+            }
+            if (busy > 0)
+            {
+                bwp.transmitter->Transmit(psd, m_period);
+            }
+            m_busyRbgs += busy;
+            m_rbgs += numRbg;
+        }
+        Simulator::Schedule(m_period, &InterferenceOnlyGnb::Update, this);
+    }
+
+    Ptr<Node> m_node;
+    Ptr<Node> m_ueNode; //!< the UE of the cell, for the UL BWPs
+    double m_load;
+    Time m_period;
+    Ptr<UniformRandomVariable> m_uniform;
+    std::vector<Bwp> m_bwps;
+    uint64_t m_busyRbgs{0};
+    uint64_t m_rbgs{0};
+};
+
+/**
+ * NrEesmIrT1 with a tabulated fast path for first transmissions.
+ *
+ * The code-block BLER of the reference model is sampled once per process on a
+ * grid of MCS, TB size class (powers of two bytes) and effective SINR, by
+ * evaluating the reference model at a flat SINR. A first transmission then
+ * costs the EESM sum over its RBs and a linear interpolation in the table,
+ * the TB BLER following from the number of code blocks of its actual size.
+ * Retransmissions combine the SINR history of the HARQ process and still go
+ * through the reference model. The table can be kept in a file, which later
+ * runs map read-only instead of rebuilding it. One fast-path TB in every
+ * validation interval is also evaluated by the reference model, and the TB
+ * BLER error is reported.
+ */
+class TabulatedEesmIrT1 : public NrEesmIrT1
+{
+  public:
+    static TypeId GetTypeId()
+    {
+        static TypeId tid = TypeId("ns3::TabulatedEesmIrT1")
+                                .SetParent<NrEesmIrT1>()
+                                .SetGroupName("Nr")
+                                .AddConstructor<TabulatedEesmIrT1>();
+        return tid;
+    }
+
+    /// File the table is mapped from, or written to when it does not exist yet
+    static void SetTableFile(const std::string& filename)
+    {
+        s_tableFile = filename;
+    }
+
+    /// Check one fast-path TB in every interval against the reference model (0: never)
+    static void SetValidationInterval(uint32_t interval)
+    {
+        s_validationInterval = interval;
+    }
+
+    /// Clear the validation counters, between two runs of a batch
+    static void ResetValidation()
+    {
+        s_fastTbs = 0;
+        s_validated = 0;
+        s_errorSum = 0.0;
+        s_errorMax = 0.0;
+    }
+
+    static void WriteValidation(std::ostream& os)
+    {
+        os << "\n  Tabulated BLER: " << s_fastTbs << " TBs from the table, " << s_validated
+           << " checked against the reference model, TBLER error mean "
+           << (s_validated > 0 ? s_errorSum / s_validated : 0.0) << " max " << s_errorMax << "\n";
+    }
+
+    Ptr<NrErrorModelOutput> GetTbDecodificationStats(
+        const SpectrumValue& sinr,
+        const std::vector<int>& map,
+        uint32_t size,
+        uint8_t mcs,
+        const NrErrorModelHistory& sinrHistory) override
+    {
+        if (!sinrHistory.empty() || map.empty())
+        {
+            return NrEesmIrT1::GetTbDecodificationStats(sinr, map, size, mcs, sinrHistory);
+        }
+        const float* table = GetTable(sinr.GetSpectrumModel());
+
+        // EESM effective SINR of the allocated RBs
+        double beta = GetBetaTable()->at(mcs);
+        double sum = 0.0;
+        for (int rb : map)
+        {
+            sum += std::exp(-sinr[rb] / beta);
+        }
+        double sinrEff = -beta * std::log(sum / map.size());
+
+        double position = (10 * std::log10(sinrEff) - MIN_SINR_DB) / SINR_STEP_DB;
+        position = std::clamp(position, 0.0, NUM_SINR - 1.0);
+        uint32_t i = std::min(static_cast<uint32_t>(position), NUM_SINR - 2);
+        const float* row = table + (mcs * NUM_SIZE_CLASSES + SizeClass(size)) * NUM_SINR;
+        double cbBler = row[i] + (position - i) * (row[i + 1] - row[i]);
+        double codeRate = GetMcsEcrTable()->at(mcs);
+        double tbler = 1 - std::pow(1 - cbBler, CodeBlocks(size * 8, codeRate));
+
+        Ptr<NrEesmErrorModelOutput> output = Create<NrEesmErrorModelOutput>(tbler);
+        output->m_sinrEff = sinrEff;
+        output->m_sinr = sinr;
+        output->m_map = map;
+        output->m_infoBits = size * 8;
+        output->m_codeBits = size * 8 / codeRate;
+
+        s_fastTbs++;
+        if (s_validationInterval > 0 && s_fastTbs % s_validationInterval == 0)
+        {
+            double reference =
+                NrEesmIrT1::GetTbDecodificationStats(sinr, map, size, mcs, sinrHistory)->m_tbler;
+            s_validated++;
+            s_errorSum += std::abs(tbler - reference);
+            s_errorMax = std::max(s_errorMax, std::abs(tbler - reference));
+        }
+        return output;
+    }
+
+  private:
+    static constexpr double MIN_SINR_DB = -10.0;
+    static constexpr double SINR_STEP_DB = 0.25;
+    static constexpr uint32_t NUM_SINR = 201;         //!< -10 dB to 40 dB
+    static constexpr uint32_t NUM_SIZE_CLASSES = 18;  //!< 1 B to 256 kB
+    static constexpr char TABLE_MAGIC[8] = "NRBLER1";
+
+    /// File header of a stored table
+    struct TableHeader
+    {
+        char magic[8];
+        uint32_t numMcs;
+        uint32_t numSizeClasses;
+        uint32_t numSinr;
+        float minSinrDb;
+        float sinrStepDb;
+    };
+
+    static uint32_t SizeClass(uint32_t sizeBytes)
+    {
+        uint32_t sizeClass = 0;
+        while (sizeClass + 1 < NUM_SIZE_CLASSES && (2u << sizeClass) <= sizeBytes)
+        {
+            sizeClass++;
+        }
+        return sizeClass;
+    }
+
+    /// Number of LDPC code blocks of a TB (TS 38.212, 5.2.2)
+    static uint32_t CodeBlocks(uint32_t sizeBit, double codeRate)
+    {
+        uint32_t b = sizeBit + (sizeBit > 3824 ? 24 : 16);
+        bool baseGraph2 = b <= 292 || (b <= 3824 && codeRate <= 0.67) || codeRate <= 0.25;
+        uint32_t kcb = baseGraph2 ? 3840 : 8448;
+        return b <= kcb ? 1 : static_cast<uint32_t>(std::ceil(static_cast<double>(b) / (kcb - 24)));
+    }
+
+    /// The process-wide table: mapped from the table file, or built from this model
+    const float* GetTable(Ptr<const SpectrumModel> model)
+    {
+        if (s_table != nullptr)
+        {
+            return s_table;
+        }
+        uint32_t numMcs = GetMcsEcrTable()->size();
+        size_t values = static_cast<size_t>(numMcs) * NUM_SIZE_CLASSES * NUM_SINR;
+        if (!s_tableFile.empty() && (s_table = MapTable(numMcs, values)) != nullptr)
+        {
+            return s_table;
+        }
+
+        static std::vector<float> built(values);
+        SpectrumValue flat(model);
+        const std::vector<int> oneRb{0};
+        for (uint32_t mcs = 0; mcs < numMcs; ++mcs)
+        {
+            double codeRate = GetMcsEcrTable()->at(mcs);
+            for (uint32_t sizeClass = 0; sizeClass < NUM_SIZE_CLASSES; ++sizeClass)
+            {
+                uint32_t size = (3u << sizeClass) / 2;
+                double codeBlocks = CodeBlocks(size * 8, codeRate);
+                float* row = built.data() + (mcs * NUM_SIZE_CLASSES + sizeClass) * NUM_SINR;
+                for (uint32_t i = 0; i < NUM_SINR; ++i)
+                {
+                    flat[0] = std::pow(10.0, (MIN_SINR_DB + i * SINR_STEP_DB) / 10);
+                    double tbler =
+                        NrEesmIrT1::GetTbDecodificationStats(flat, oneRb, size, mcs, {})->m_tbler;
+                    row[i] = 1 - std::pow(1 - tbler, 1 / codeBlocks);
+                }
+            }
+        }
+        s_table = built.data();
+
+        if (!s_tableFile.empty())
+        {
+            TableHeader header{};
+            std::copy(std::begin(TABLE_MAGIC), std::end(TABLE_MAGIC), header.magic);
+            header.numMcs = numMcs;
+            header.numSizeClasses = NUM_SIZE_CLASSES;
+            header.numSinr = NUM_SINR;
+            header.minSinrDb = MIN_SINR_DB;
+            header.sinrStepDb = SINR_STEP_DB;
+            // Other runs may have the file mapped: write a private copy and rename it over
+            // the old one, so that they keep a complete table and never see a partial one
+            std::string tmpFile = s_tableFile + ".tmp." + std::to_string(getpid());
+            std::ofstream file(tmpFile.c_str(),
+                               std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            file.write(reinterpret_cast<const char*>(built.data()), values * sizeof(float));
+            file.close();
+            if (!file || std::rename(tmpFile.c_str(), s_tableFile.c_str()) != 0)
+            {
+                std::cerr << "Warning: could not write the BLER table " << s_tableFile << ": "
+                          << std::strerror(errno) << "\n";
+                std::remove(tmpFile.c_str());
+            }
+        }
+        return s_table;
+    }
+
+    /// Map a stored table read-only; nullptr if missing or built for another grid
+    static const float* MapTable(uint32_t numMcs, size_t values)
+    {
+        int fd = open(s_tableFile.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return nullptr;
+        }
+        size_t length = sizeof(TableHeader) + values * sizeof(float);
+        struct stat st;
+        void* data = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) == length)
+        {
+            data = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+        if (data == MAP_FAILED)
+        {
+            return nullptr;
+        }
+        const TableHeader* header = static_cast<const TableHeader*>(data);
+        if (!std::equal(std::begin(TABLE_MAGIC), std::end(TABLE_MAGIC), header->magic) ||
+            header->numMcs != numMcs || header->numSizeClasses != NUM_SIZE_CLASSES ||
+            header->numSinr != NUM_SINR || header->minSinrDb != static_cast<float>(MIN_SINR_DB) ||
+            header->sinrStepDb != static_cast<float>(SINR_STEP_DB))
+        {
+            munmap(data, length);
+            return nullptr;
+        }
+        // Kept mapped for the rest of the process
+        return reinterpret_cast<const float*>(header + 1);
+    }
+
+    static inline std::string s_tableFile;
+    static inline const float* s_table{nullptr};
+    static inline uint32_t s_validationInterval{1000};
+    static inline uint64_t s_fastTbs{0};
+    static inline uint64_t s_validated{0};
+    static inline double s_errorSum{0.0};
+    static inline double s_errorMax{0.0};
+};
+
+NS_OBJECT_ENSURE_REGISTERED(TabulatedEesmIrT1);
+
+/**
+ * Estimated RLC transmission buffer of every data radio bearer: the bytes
+ * handed down by PDCP minus the bytes taken by the MAC, less the 2-byte RLC UM
+ * header of each PDU. The length indicators of concatenated SDUs are not
+ * visible in the traces, so the estimate is floored at zero. DL bearers are
+ * tracked at the gNB and UL bearers at the UE; the slice of a bearer follows
+ * from its LCID.
+ */
+class RlcQueueMonitor
+{
+  public:
+    /// Node, RNTI and LCID of a bearer
+    using BearerId = std::tuple<uint32_t, uint16_t, uint8_t>;
+
+    RlcQueueMonitor(const std::vector<std::string>& slices,
+                    const std::map<uint8_t, std::string>& sliceByLcid)
+        : m_slices(slices),
+          m_sliceBytes(slices.size(), 0)
+    {
+        for (const auto& [lcid, slice] : sliceByLcid)
+        {
+            auto it = std::find(m_slices.begin(), m_slices.end(), slice);
+            if (it != m_slices.end())
+            {
+                m_sliceByLcid[lcid] = it - m_slices.begin();
+            }
+        }
+    }
+
+    /**
+     * Connect the PDCP and RLC transmission traces of the gNBs (DL) and UEs
+     * (UL). The radio bearers only exist once the UEs are attached, so this is
+     * called at application start.
+     */
+    void Connect(const NetDeviceContainer& gnbNetDev, const NetDeviceContainer& ueNetDev)
+    {
+        for (uint32_t i = 0; i < gnbNetDev.GetN(); ++i)
+        {
+            uint32_t nodeId = gnbNetDev.Get(i)->GetNode()->GetId();
+            ConnectBearers("/NodeList/" + std::to_string(nodeId) +
+                               "/DeviceList/*/$ns3::NrGnbNetDevice/NrGnbRrc/UeMap/*/"
+                               "DataRadioBearerMap/*/",
+                           nodeId);
+        }
+        for (uint32_t i = 0; i < ueNetDev.GetN(); ++i)
+        {
+            uint32_t nodeId = ueNetDev.Get(i)->GetNode()->GetId();
+            ConnectBearers("/NodeList/" + std::to_string(nodeId) +
+                               "/DeviceList/*/$ns3::NrUeNetDevice/NrUeRrc/DataRadioBearerMap/*/",
+                           nodeId);
+        }
+    }
+
+    const std::vector<std::string>& GetSlices() const
+    {
+        return m_slices;
+    }
+
+    /// Queued bytes of all the bearers of a slice, by index in GetSlices()
+    int64_t GetSliceBytes(size_t slice) const
+    {
+        return m_sliceBytes[slice];
+    }
+
+    /// Queued bytes of the bearers of a slice at one node: DL at a gNB, UL at a UE
+    int64_t GetNodeSliceBytes(uint32_t nodeId, size_t slice) const
+    {
+        int64_t bytes = 0;
+        for (auto it = m_bearers.lower_bound({nodeId, 0, 0});
+             it != m_bearers.end() && std::get<0>(it->first) == nodeId;
+             ++it)
+        {
+            bytes += it->second.slice == slice ? it->second.bytes : 0;
+        }
+        return bytes;
+    }
+
+    /// Queued bytes of every bearer seen so far
+    std::map<BearerId, int64_t> GetBearerBytes() const
+    {
+        std::map<BearerId, int64_t> bytes;
+        for (const auto& [id, bearer] : m_bearers)
+        {
+            bytes[id] = bearer.bytes;
+        }
+        return bytes;
+    }
+
+  private:
+    static constexpr int64_t RLC_UM_HEADER = 2;
+
+    struct Bearer
+    {
+        int64_t bytes{0};
+        size_t slice; //!< index in m_slices, or m_slices.size() if the LCID has no slice
+    };
+
+    void ConnectBearers(const std::string& prefix, uint32_t nodeId)
+    {
+        Config::ConnectWithoutContext(
+            prefix + "NrPdcp/TxPDU",
+            MakeBoundCallback(&RlcQueueMonitor::NotifyPdcpTx, this, nodeId));
+        Config::ConnectWithoutContext(
+            prefix + "NrRlc/TxPDU",
+            MakeBoundCallback(&RlcQueueMonitor::NotifyRlcTx, this, nodeId));
+    }
+
+    static void NotifyPdcpTx(RlcQueueMonitor* self,
+                             uint32_t nodeId,
+                             uint16_t rnti,
+                             uint8_t lcid,
+                             uint32_t size)
+    {
+        self->Update({nodeId, rnti, lcid}, size);
+    }
+
+    static void NotifyRlcTx(RlcQueueMonitor* self,
+                            uint32_t nodeId,
+                            uint16_t rnti,
+                            uint8_t lcid,
+                            uint32_t size)
+    {
+        self->Update({nodeId, rnti, lcid}, RLC_UM_HEADER - static_cast<int64_t>(size));
+    }
+
+    void Update(const BearerId& id, int64_t delta)
+    {
+        auto it = m_bearers.find(id);
+        if (it == m_bearers.end())
+        {
+            auto slice = m_sliceByLcid.find(std::get<2>(id));
+            it = m_bearers
+                     .emplace(id,
+                              Bearer{0,
+                                     slice != m_sliceByLcid.end() ? slice->second
+                                                                  : m_slices.size()})
+                     .first;
+        }
+        Bearer& bearer = it->second;
+        int64_t bytes = std::max<int64_t>(0, bearer.bytes + delta);
+        if (bearer.slice < m_slices.size())
+        {
+            m_sliceBytes[bearer.slice] += bytes - bearer.bytes;
+        }
+        bearer.bytes = bytes;
+    }
+
+    std::vector<std::string> m_slices;
+    std::map<uint8_t, size_t> m_sliceByLcid;
+    std::map<BearerId, Bearer> m_bearers;
+    std::vector<int64_t> m_sliceBytes;
+};
+
+/**
+ * TDMA scheduler of every BWP when voice shares the video BWP.
+ *
+ * It orders the UEs like the QoS variant only on the BWP that EnableSharedBwp
+ * is called for; the other BWPs keep the round robin of the default scheduler.
+ * With mini-slots, a UE whose URLLC (voice) logical channel holds data gets a
+ * URLLC-only allocation: the buffers of its other logical channels are hidden
+ * from the scheduler until the URLLC one is empty, and the allocation is padded
+ * to whole mini-slots (PDSCH mapping type B, 2, 4 or 7 symbols). The voice TB
+ * thus ends after its mini-slots instead of after the video data, which resumes
+ * in the next slot.
+ *
+ * The nr module decodes one TB per UE and slot, at its end, and cannot place a
+ * mini-slot inside a TB it has already scheduled. Preemption is emulated on the
+ * eMBB side: the scheduling stays the same, and when URLLC data arrives the TB
+ * of the UE still waiting for its HARQ feedback (the eMBB TB in flight) is
+ * punctured. Its feedback is turned into a NACK, so HARQ retransmits it.
+ */
+class SharedBwpScheduler : public NrMacSchedulerTdmaQos
+{
+  public:
+    static TypeId GetTypeId()
+    {
+        static TypeId tid = TypeId("ns3::SharedBwpScheduler")
+                                .SetParent<NrMacSchedulerTdmaQos>()
+                                .SetGroupName("Nr")
+                                .AddConstructor<SharedBwpScheduler>();
+        return tid;
+    }
+
+    /// Called with the RNTI and HARQ process of every punctured eMBB TB
+    using PunctureCallback = std::function<void(uint16_t, uint8_t)>;
+
+    /**
+     * Schedule this BWP as the shared one: QoS ordering, with mini-slots of
+     * miniSlotSymbols (0: slot-based) for the logical channel urllcLcid
+     */
+    void EnableSharedBwp(uint8_t urllcLcid, uint8_t miniSlotSymbols, bool preemption)
+    {
+        m_qosOrdering = true;
+        m_urllcLcid = urllcLcid;
+        m_miniSlotSymbols = miniSlotSymbols;
+        m_preemption = preemption;
+    }
+
+    void SetPunctureCallback(PunctureCallback callback)
+    {
+        m_punctureCallback = std::move(callback);
+    }
+
+    /// DL allocations of the BWP (MAC trace): first transmissions carrying eMBB data
+    void NotifyDlScheduling(NrSchedulingCallbackInfo info)
+    {
+        if (m_preemption && info.m_rv == 0 && !HasUrllcData(info.m_rnti))
+        {
+            m_inFlight[info.m_rnti] = info.m_harqId;
+        }
+    }
+
+    void DoSchedDlRlcBufferReq(
+        const NrMacSchedSapProvider::SchedDlRlcBufferReqParameters& params) override
+    {
+        if (m_miniSlotSymbols == 0)
+        {
+            NrMacSchedulerTdmaQos::DoSchedDlRlcBufferReq(params);
+            return;
+        }
+        Ue& ue = m_ues[params.m_rnti];
+        if (params.m_logicalChannelIdentity != m_urllcLcid)
+        {
+            ue.embb[params.m_logicalChannelIdentity] = params;
+            NrMacSchedulerTdmaQos::DoSchedDlRlcBufferReq(ue.urllcData ? Hidden(params) : params);
+            return;
+        }
+        NrMacSchedulerTdmaQos::DoSchedDlRlcBufferReq(params);
+        bool urllcData = params.m_rlcTransmissionQueueSize + params.m_rlcRetransmissionQueueSize +
+                             params.m_rlcStatusPduSize >
+                         0;
+        if (urllcData == ue.urllcData)
+        {
+            return;
+        }
+        ue.urllcData = urllcData;
+        if (urllcData)
+        {
+            Puncture(params.m_rnti);
+        }
+        for (const auto& [lcid, embb] : ue.embb)
+        {
+            NrMacSchedulerTdmaQos::DoSchedDlRlcBufferReq(urllcData ? Hidden(embb) : embb);
+        }
+    }
+
+    /// HARQ feedback of the punctured TBs becomes a NACK
+    void DoSchedDlTriggerReq(
+        const NrMacSchedSapProvider::SchedDlTriggerReqParameters& params) override
+    {
+        if (m_inFlight.empty() && m_punctured.empty())
+        {
+            NrMacSchedulerTdmaQos::DoSchedDlTriggerReq(params);
+            return;
+        }
+        NrMacSchedSapProvider::SchedDlTriggerReqParameters feedback = params;
+        for (DlHarqInfo& harq : feedback.m_dlHarqInfoList)
+        {
+            auto inFlight = m_inFlight.find(harq.m_rnti);
+            if (inFlight != m_inFlight.end() && inFlight->second == harq.m_harqProcessId)
+            {
+                m_inFlight.erase(inFlight);
+            }
+            if (m_punctured.erase({harq.m_rnti, harq.m_harqProcessId}) > 0)
+            {
+                harq.m_harqStatus = DlHarqInfo::NACK;
+            }
+        }
+        NrMacSchedulerTdmaQos::DoSchedDlTriggerReq(feedback);
+    }
+
+  protected:
+    std::function<bool(const UePtrAndBufferReq&, const UePtrAndBufferReq&)> GetUeCompareDlFn()
+        const override
+    {
+        return m_qosOrdering ? NrMacSchedulerTdmaQos::GetUeCompareDlFn()
+                             : NrMacSchedulerUeInfoRR::CompareUeWeightsDl;
+    }
+
+    std::function<bool(const UePtrAndBufferReq&, const UePtrAndBufferReq&)> GetUeCompareUlFn()
+        const override
+    {
+        return m_qosOrdering ? NrMacSchedulerTdmaQos::GetUeCompareUlFn()
+                             : NrMacSchedulerUeInfoRR::CompareUeWeightsUl;
+    }
+
+    /// URLLC allocations are padded to whole mini-slots, within the symbols left
+    std::shared_ptr<DciInfoElementTdma> CreateDlDci(
+        PointInFTPlane* spoint,
+        const std::shared_ptr<NrMacSchedulerUeInfo>& ueInfo,
+        uint32_t maxSym) const override
+    {
+        auto dci = NrMacSchedulerTdmaQos::CreateDlDci(spoint, ueInfo, maxSym);
+        if (!dci || !HasUrllcData(ueInfo->m_rnti))
+        {
+            return dci;
+        }
+        uint32_t miniSlots = (dci->m_numSym + m_miniSlotSymbols - 1) / m_miniSlotSymbols;
+        uint32_t numSym = std::max<uint32_t>(dci->m_numSym,
+                                             std::min(miniSlots * m_miniSlotSymbols, maxSym));
+        spoint->m_sym += numSym - dci->m_numSym;
+        return std::make_shared<DciInfoElementTdma>(dci->m_symStart,
+                                                    numSym,
+                                                    dci->m_ndi,
+                                                    dci->m_rv,
+                                                    *dci);
+    }
+
+  private:
+    struct Ue
+    {
+        bool urllcData{false};
+        std::map<uint8_t, NrMacSchedSapProvider::SchedDlRlcBufferReqParameters> embb; //!< by LCID
+    };
+
+    bool HasUrllcData(uint16_t rnti) const
+    {
+        auto ue = m_ues.find(rnti);
+        return m_miniSlotSymbols > 0 && ue != m_ues.end() && ue->second.urllcData;
+    }
+
+    static NrMacSchedSapProvider::SchedDlRlcBufferReqParameters Hidden(
+        NrMacSchedSapProvider::SchedDlRlcBufferReqParameters params)
+    {
+        params.m_rlcTransmissionQueueSize = 0;
+        params.m_rlcTransmissionQueueHolDelay = 0;
+        params.m_rlcRetransmissionQueueSize = 0;
+        params.m_rlcRetransmissionHolDelay = 0;
+        params.m_rlcStatusPduSize = 0;
+        return params;
+    }
+
+    void Puncture(uint16_t rnti)
+    {
+        auto victim = m_inFlight.find(rnti);
+        if (!m_preemption || victim == m_inFlight.end())
+        {
+            return;
+        }
+        m_punctured.insert({rnti, victim->second});
+        if (m_punctureCallback)
+        {
+            m_punctureCallback(rnti, victim->second);
+        }
+        m_inFlight.erase(victim);
+    }
+
+    bool m_qosOrdering{false};
+    uint8_t m_urllcLcid{0};
+    uint8_t m_miniSlotSymbols{0};
+    bool m_preemption{false};
+    PunctureCallback m_punctureCallback;
+    std::map<uint16_t, Ue> m_ues;                      //!< per RNTI
+    std::map<uint16_t, uint8_t> m_inFlight;            //!< eMBB TB awaiting feedback, per RNTI
+    std::set<std::pair<uint16_t, uint8_t>> m_punctured; //!< (RNTI, HARQ process) to NACK
+};
+
+NS_OBJECT_ENSURE_REGISTERED(SharedBwpScheduler);
+
+/**
+ * DL allocations of the BWP that voice shares with video.
+ *
+ * A slot is contended when both the voice and the video DL RLC buffers of its
+ * cell held data when it was scheduled, and alone otherwise. The HARQ
+ * retransmissions of the TBs of each class are followed back to their first
+ * transmission, and those of the eMBB TBs punctured by a mini-slot
+ * (SharedBwpScheduler) back to the puncture. Allocation lengths are counted
+ * in classes of 1-2, 3-4, 5-7 and 8-14 symbols, i.e. by mini-slot length.
+ */
+class SharedBwpMonitor
+{
+  public:
+    explicit SharedBwpMonitor(const RlcQueueMonitor& queues)
+        : m_queues(queues)
+    {
+        const std::vector<std::string>& slices = queues.GetSlices();
+        m_voice = std::find(slices.begin(), slices.end(), "voice") - slices.begin();
+        m_video = std::find(slices.begin(), slices.end(), "video") - slices.begin();
+    }
+
+    void Connect(const NetDeviceContainer& gnbNetDev, uint16_t bwpId)
+    {
+        for (uint32_t i = 0; i < gnbNetDev.GetN(); ++i)
+        {
+            uint16_t cellId = DynamicCast<NrGnbNetDevice>(gnbNetDev.Get(i))->GetCellId();
+            m_slots[cellId].nodeId = gnbNetDev.Get(i)->GetNode()->GetId();
+            NrHelper::GetGnbMac(gnbNetDev.Get(i), bwpId)
+                ->TraceConnectWithoutContext(
+                    "DlScheduling",
+                    MakeBoundCallback(&SharedBwpMonitor::NotifyDlScheduling, this, cellId));
+            DynamicCast<SharedBwpScheduler>(NrHelper::GetScheduler(gnbNetDev.Get(i), bwpId))
+                ->SetPunctureCallback([this, cellId](uint16_t rnti, uint8_t harqId) {
+                    m_victims[{cellId, rnti, harqId}] = Simulator::Now();
+                    m_punctured++;
+                });
+        }
+    }
+
+    void WriteSummary(std::ostream& os)
+    {
+        for (auto& [cellId, slot] : m_slots)
+        {
+            Flush(cellId, slot);
+        }
+        os << "\n  Shared BWP DL allocations (symbols 1-2/3-4/5-7/8-14): " << m_lengths[0] << "/"
+           << m_lengths[1] << "/" << m_lengths[2] << "/" << m_lengths[3] << "\n";
+        const char* names[] = {"alone (one slice backlogged)",
+                               "contended (voice and video backlogged)"};
+        for (int contended = 0; contended < 2; ++contended)
+        {
+            const TbClass& c = m_classes[contended];
+            os << "  TBs " << names[contended] << ": " << c.tbs << " in " << c.slots
+               << " slots, HARQ retx " << c.retx << " ("
+               << (c.tbs > 0 ? 100.0 * c.retx / c.tbs : 0.0) << " %), mean retx delay "
+               << (c.retx > 0 ? c.retxDelayMs / c.retx : 0.0) << " ms\n";
+        }
+        os << "  eMBB TBs punctured by a mini-slot: " << m_punctured << ", HARQ retx "
+           << m_victimRetx << ", mean delay from the puncture to the retx "
+           << (m_victimRetx > 0 ? m_victimRetxDelayMs / m_victimRetx : 0.0) << " ms\n";
+    }
+
+  private:
+    struct Slot
+    {
+        uint32_t nodeId{0};
+        uint32_t key{std::numeric_limits<uint32_t>::max()};
+        bool contended{false};
+        std::vector<NrSchedulingCallbackInfo> allocations;
+        Time time;
+    };
+
+    struct TbClass
+    {
+        uint64_t slots{0};
+        uint64_t tbs{0};
+        uint64_t retx{0};
+        double retxDelayMs{0.0};
+    };
+
+    struct FirstTx
+    {
+        bool contended;
+        Time time;
+    };
+
+    /// The allocations of a slot are traced together: buffer them until the slot changes.
+    /// The backlogs are read when the slot is scheduled, before its data leaves the RLC
+    static void NotifyDlScheduling(SharedBwpMonitor* self,
+                                   uint16_t cellId,
+                                   NrSchedulingCallbackInfo info)
+    {
+        Slot& slot = self->m_slots[cellId];
+        uint32_t key = (info.m_frameNum << 16) | (info.m_subframeNum << 8) | info.m_slotNum;
+        if (key != slot.key)
+        {
+            self->Flush(cellId, slot);
+            slot.key = key;
+            slot.time = Simulator::Now();
+            slot.contended = self->m_queues.GetNodeSliceBytes(slot.nodeId, self->m_voice) > 0 &&
+                             self->m_queues.GetNodeSliceBytes(slot.nodeId, self->m_video) > 0;
+        }
+        slot.allocations.push_back(info);
+    }
+
+    void Flush(uint16_t cellId, Slot& slot)
+    {
+        if (!slot.allocations.empty())
+        {
+            m_classes[slot.contended].slots++;
+        }
+        for (const NrSchedulingCallbackInfo& info : slot.allocations)
+        {
+            uint8_t length = info.m_numSym;
+            m_lengths[length <= 2 ? 0 : length <= 4 ? 1 : length <= 7 ? 2 : 3]++;
+            auto process = std::make_tuple(cellId, info.m_rnti, info.m_harqId);
+            if (info.m_rv == 0)
+            {
+                m_classes[slot.contended].tbs++;
+                m_firstTx[process] = {slot.contended, slot.time};
+            }
+            else
+            {
+                auto first = m_firstTx.find(process);
+                if (first != m_firstTx.end())
+                {
+                    TbClass& c = m_classes[first->second.contended];
+                    c.retx++;
+                    c.retxDelayMs += (slot.time - first->second.time).GetSeconds() * 1000;
+                }
+                auto victim = m_victims.find(process);
+                if (victim != m_victims.end())
+                {
+                    m_victimRetx++;
+                    m_victimRetxDelayMs += (slot.time - victim->second).GetSeconds() * 1000;
+                    m_victims.erase(victim);
+                }
+            }
+        }
+        slot.allocations.clear();
+    }
+
+    const RlcQueueMonitor& m_queues;
+    size_t m_voice; //!< slice indices in the queue monitor
+    size_t m_video;
+    std::map<uint16_t, Slot> m_slots; //!< slot being traced, per cell
+    std::map<std::tuple<uint16_t, uint16_t, uint8_t>, FirstTx> m_firstTx; //!< per HARQ process
+    TbClass m_classes[2];                                                 //!< alone, contended
+    uint64_t m_lengths[4]{};
+    std::map<std::tuple<uint16_t, uint16_t, uint8_t>, Time> m_victims; //!< punctured, not retx yet
+    uint64_t m_punctured{0};
+    uint64_t m_victimRetx{0};
+    double m_victimRetxDelayMs{0.0};
+};
+
+/**
+ * Live metrics of the running simulation in the Prometheus text format,
+ * served over HTTP on a loopback port by a thread of its own.
+ *
+ * The simulator thread never takes a lock: per received packet it adds to the
+ * per-slice atomic counters, and once per sampling interval of simulated time
+ * it stores the simulated time, the executed event count, the event rate and
+ * the per-slice throughput, delay and RLC queue gauges. The server thread
+ * only loads these values, and reads the RSS when it is scraped. A run that
+ * stalls shows as a growing nr_sim_sample_age_seconds.
+ */
+class MetricsExporter
+{
+  public:
+    MetricsExporter(uint16_t port, const RlcQueueMonitor& queues, Time interval)
+        : m_queues(queues),
+          m_interval(interval),
+          m_slices(queues.GetSlices().size())
+    {
+        m_socket = socket(AF_INET, SOCK_STREAM, 0);
+        int reuse = 1;
+        setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        NS_ABORT_MSG_IF(m_socket < 0 ||
+                            bind(m_socket, reinterpret_cast<sockaddr*>(&address),
+                                 sizeof(address)) < 0 ||
+                            listen(m_socket, 4) < 0,
+                        "Cannot listen on 127.0.0.1:" << port << " for the metrics");
+        m_server = std::thread(&MetricsExporter::Serve, this);
+    }
+
+    ~MetricsExporter()
+    {
+        m_stop = true;
+        m_server.join();
+        close(m_socket);
+    }
+
+    /// Count the packets received by the UDP servers, per slice of their port
+    void ConnectServers(const ApplicationContainer& servers,
+                        const std::map<uint16_t, std::string>& sliceByPort)
+    {
+        const std::vector<std::string>& slices = m_queues.GetSlices();
+        for (uint32_t i = 0; i < servers.GetN(); ++i)
+        {
+            UintegerValue port;
+            servers.Get(i)->GetAttribute("Port", port);
+            auto slice = sliceByPort.find(port.Get());
+            if (slice == sliceByPort.end())
+            {
+                continue;
+            }
+            auto it = std::find(slices.begin(), slices.end(), slice->second);
+            if (it != slices.end())
+            {
+                servers.Get(i)->TraceConnectWithoutContext(
+                    "Rx",
+                    MakeBoundCallback(&MetricsExporter::NotifyRx,
+                                      &m_slices[it - slices.begin()]));
+            }
+        }
+    }
+
+    void Start()
+    {
+        m_lastWallTime = std::chrono::steady_clock::now();
+        Sample();
+    }
+
+  private:
+    struct SliceMetrics
+    {
+        std::atomic<uint64_t> rxPackets{0};
+        std::atomic<uint64_t> rxBytes{0};
+        std::atomic<uint64_t> delayNs{0};
+        // Gauges over the last sampling interval
+        std::atomic<double> throughputMbps{0.0};
+        std::atomic<double> delayMs{0.0};
+        std::atomic<int64_t> queueBytes{0};
+        // Values at the previous sample, only used by the simulator thread
+        uint64_t lastPackets{0};
+        uint64_t lastBytes{0};
+        uint64_t lastDelayNs{0};
+    };
+
+    static void NotifyRx(SliceMetrics* slice, Ptr<const Packet> packet)
+    {
+        SeqTsHeader seqTs;
+        packet->PeekHeader(seqTs);
+        slice->rxPackets.fetch_add(1, std::memory_order_relaxed);
+        slice->rxBytes.fetch_add(packet->GetSize(), std::memory_order_relaxed);
+        slice->delayNs.fetch_add((Simulator::Now() - seqTs.GetTs()).GetNanoSeconds(),
+                                 std::memory_order_relaxed);
+    }
+
+    void Sample()
+    {
+        auto wallTime = std::chrono::steady_clock::now();
+        uint64_t events = Simulator::GetEventCount();
+        double wallS = std::chrono::duration<double>(wallTime - m_lastWallTime).count();
+        if (wallS > 0)
+        {
+            m_eventRate.store((events - m_lastEvents) / wallS, std::memory_order_relaxed);
+        }
+        m_lastWallTime = wallTime;
+        m_lastEvents = events;
+
+        for (size_t i = 0; i < m_slices.size(); ++i)
+        {
+            SliceMetrics& slice = m_slices[i];
+            uint64_t packets = slice.rxPackets.load(std::memory_order_relaxed);
+            uint64_t bytes = slice.rxBytes.load(std::memory_order_relaxed);
+            uint64_t delayNs = slice.delayNs.load(std::memory_order_relaxed);
+            slice.throughputMbps.store((bytes - slice.lastBytes) * 8 / m_interval.GetSeconds() /
+                                           1e6,
+                                       std::memory_order_relaxed);
+            if (packets > slice.lastPackets)
+            {
+                slice.delayMs.store((delayNs - slice.lastDelayNs) / 1e6 /
+                                        (packets - slice.lastPackets),
+                                    std::memory_order_relaxed);
+            }
+            slice.queueBytes.store(m_queues.GetSliceBytes(i), std::memory_order_relaxed);
+            slice.lastPackets = packets;
+            slice.lastBytes = bytes;
+            slice.lastDelayNs = delayNs;
+        }
+
+        m_events.store(events, std::memory_order_relaxed);
+        m_simTimeS.store(Simulator::Now().GetSeconds(), std::memory_order_relaxed);
+        m_sampleWallTimeNs.store(ToNanoSeconds(wallTime), std::memory_order_relaxed);
+        Simulator::Schedule(m_interval, &MetricsExporter::Sample, this);
+    }
+
+    /// Accept scrapes until the exporter is destroyed; any request gets the metrics
+    void Serve()
+    {
+        while (!m_stop)
+        {
+            pollfd listening{m_socket, POLLIN, 0};
+            if (poll(&listening, 1, 200) <= 0)
+            {
+                continue;
+            }
+            int client = accept(m_socket, nullptr, nullptr);
+            if (client < 0)
+            {
+                continue;
+            }
+            // The request is not parsed, only read so that the client sees a clean close
+            char request[1024];
+            pollfd readable{client, POLLIN, 0};
+            if (poll(&readable, 1, 1000) > 0 && read(client, request, sizeof(request)) < 0)
+            {
+                close(client);
+                continue;
+            }
+            std::string body = Format();
+            std::string response = "HTTP/1.0 200 OK\r\n"
+                                   "Content-Type: text/plain; version=0.0.4\r\n"
+                                   "Content-Length: " +
+                                   std::to_string(body.size()) + "\r\n\r\n" + body;
+            for (size_t sent = 0; sent < response.size();)
+            {
+                ssize_t n = write(client, response.data() + sent, response.size() - sent);
+                if (n <= 0)
+                {
+                    break;
+                }
+                sent += n;
+            }
+            close(client);
+        }
+    }
+
+    std::string Format() const
+    {
+        std::ostringstream os;
+        auto metric = [&os](const std::string& name, const std::string& type) {
+            os << "# TYPE " << name << " " << type << "\n";
+        };
+        int64_t now = ToNanoSeconds(std::chrono::steady_clock::now());
+        int64_t sampleNs = m_sampleWallTimeNs.load(std::memory_order_relaxed);
+
+        metric("nr_sim_time_seconds", "gauge");
+        os << "nr_sim_time_seconds " << m_simTimeS.load(std::memory_order_relaxed) << "\n";
+        metric("nr_sim_sample_age_seconds", "gauge");
+        os << "nr_sim_sample_age_seconds " << (sampleNs > 0 ? (now - sampleNs) / 1e9 : 0.0)
+           << "\n";
+        metric("nr_sim_events_total", "counter");
+        os << "nr_sim_events_total " << m_events.load(std::memory_order_relaxed) << "\n";
+        metric("nr_sim_events_per_second", "gauge");
+        os << "nr_sim_events_per_second " << m_eventRate.load(std::memory_order_relaxed)
+           << "\n";
+        metric("nr_sim_process_resident_bytes", "gauge");
+        os << "nr_sim_process_resident_bytes " << GetResidentBytes() << "\n";
+
+        const std::vector<std::string>& slices = m_queues.GetSlices();
+        auto perSlice = [&](const std::string& name, const std::string& type, auto value) {
+            metric(name, type);
+            for (size_t i = 0; i < slices.size(); ++i)
+            {
+                os << name << "{slice=\"" << slices[i] << "\"} " << value(m_slices[i]) << "\n";
+            }
+        };
+        perSlice("nr_sim_slice_rx_packets_total", "counter", [](const SliceMetrics& s) {
+            return s.rxPackets.load(std::memory_order_relaxed);
+        });
+        perSlice("nr_sim_slice_rx_bytes_total", "counter", [](const SliceMetrics& s) {
+            return s.rxBytes.load(std::memory_order_relaxed);
+        });
+        perSlice("nr_sim_slice_throughput_mbps", "gauge", [](const SliceMetrics& s) {
+            return s.throughputMbps.load(std::memory_order_relaxed);
+        });
+        perSlice("nr_sim_slice_delay_ms", "gauge", [](const SliceMetrics& s) {
+            return s.delayMs.load(std::memory_order_relaxed);
+        });
+        perSlice("nr_sim_slice_rlc_queue_bytes", "gauge", [](const SliceMetrics& s) {
+            return s.queueBytes.load(std::memory_order_relaxed);
+        });
+        return os.str();
+    }
+
+  public:
+    /// Resident set size of the process, from /proc/self/statm
+    static uint64_t GetResidentBytes()
+    {
+        std::ifstream statm("/proc/self/statm");
+        uint64_t pages = 0;
+        uint64_t residentPages = 0;
+        statm >> pages >> residentPages;
+        return residentPages * sysconf(_SC_PAGESIZE);
+    }
+
+  private:
+    /// Nanoseconds since the clock epoch; the period of steady_clock is left to the library
+    static int64_t ToNanoSeconds(std::chrono::steady_clock::time_point t)
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+    }
+
+    const RlcQueueMonitor& m_queues;
+    Time m_interval;
+    std::deque<SliceMetrics> m_slices;
+    int m_socket{-1};
+    std::thread m_server;
+    std::atomic<bool> m_stop{false};
+
+    std::atomic<double> m_simTimeS{0.0};
+    std::atomic<uint64_t> m_events{0};
+    std::atomic<double> m_eventRate{0.0};
+    std::atomic<int64_t> m_sampleWallTimeNs{0};
+    std::chrono::steady_clock::time_point m_lastWallTime;
+    uint64_t m_lastEvents{0};
+};
+
+/**
+ * MapScheduler (the default event scheduler) that counts its pending events,
+ * since the simulator does not expose the size of its event queue.
+ */
+class CountingMapScheduler : public MapScheduler
+{
+  public:
+    static TypeId GetTypeId()
+    {
+        static TypeId tid = TypeId("ns3::CountingMapScheduler")
+                                .SetParent<MapScheduler>()
+                                .SetGroupName("Nr")
+                                .AddConstructor<CountingMapScheduler>();
+        return tid;
+    }
+
+    void Insert(const Scheduler::Event& ev) override
+    {
+        MapScheduler::Insert(ev);
+        s_pending++;
+    }
+
+    Scheduler::Event RemoveNext() override
+    {
+        s_pending--;
+        return MapScheduler::RemoveNext();
+    }
+
+    void Remove(const Scheduler::Event& ev) override
+    {
+        MapScheduler::Remove(ev);
+        s_pending--;
+    }
+
+    static uint64_t GetPending()
+    {
+        return s_pending;
+    }
+
+    /// Forget the events of a previous run, whose scheduler was destroyed with them
+    static void ResetPending()
+    {
+        s_pending = 0;
+    }
+
+  private:
+    static inline uint64_t s_pending{0};
+};
+
+NS_OBJECT_ENSURE_REGISTERED(CountingMapScheduler);
+
+/**
+ * Periodic census of what holds memory, written as CSV rows while the
+ * simulation runs: RSS and malloc heap in use, pending and executed events
+ * (the simulator must use CountingMapScheduler), FlowMonitor flows, the
+ * packets and bytes waiting in the point-to-point device queues and queue
+ * discs, and the RLC buffers. ns-3 does not count live Packet objects, so
+ * packets are counted where they wait. The RLC buffer of every non-empty
+ * bearer goes to a second CSV, in long format.
+ */
+class MemoryCensus
+{
+  public:
+    MemoryCensus(const std::string& filename,
+                 const std::string& bearerFilename,
+                 Ptr<FlowMonitor> monitor,
+                 const RlcQueueMonitor& rlcQueues)
+        : m_csv(filename.c_str(), std::ofstream::out | std::ofstream::trunc),
+          m_bearerCsv(bearerFilename.c_str(), std::ofstream::out | std::ofstream::trunc),
+          m_monitor(monitor),
+          m_rlcQueues(rlcQueues)
+    {
+        m_csv << "time_ms,rss_kb,heap_kb,events_pending,events_executed,flows,queued_packets,"
+                 "queued_bytes,rlc_bytes,rlc_bearers\n";
+        m_bearerCsv << "time_ms,node,rnti,lcid,bytes\n";
+    }
+
+    void Start(Time start, Time interval)
+    {
+        m_interval = interval;
+        Simulator::Schedule(start, &MemoryCensus::Sample, this);
+    }
+
+    void WriteSummary(std::ostream& os) const
+    {
+        os << "\n  Memory census: " << m_samples << " samples, peak RSS " << m_peakRssKb / 1024
+           << " MB at " << m_peakRssTimeMs << " ms, max " << m_maxPending
+           << " pending events, max " << m_maxQueuedPackets << " queued packets\n";
+    }
+
+  private:
+    /// Device queues and root queue discs of the point-to-point links, which exist by now
+    void FindQueues()
+    {
+        for (uint32_t n = 0; n < NodeList::GetNNodes(); ++n)
+        {
+            Ptr<Node> node = NodeList::GetNode(n);
+            Ptr<TrafficControlLayer> tc = node->GetObject<TrafficControlLayer>();
+            for (uint32_t d = 0; d < node->GetNDevices(); ++d)
+            {
+                Ptr<NetDevice> device = node->GetDevice(d);
+                Ptr<PointToPointNetDevice> p2p = DynamicCast<PointToPointNetDevice>(device);
+                if (p2p && p2p->GetQueue())
+                {
+                    m_queues.push_back(p2p->GetQueue());
+                }
+                Ptr<QueueDisc> queueDisc = tc ? tc->GetRootQueueDiscOnDevice(device) : nullptr;
+                if (queueDisc)
+                {
+                    m_queueDiscs.push_back(queueDisc);
+                }
+            }
+        }
+    }
+
+    void Sample()
+    {
+        if (m_samples == 0)
+        {
+            FindQueues();
+        }
+        uint64_t queuedPackets = 0;
+        uint64_t queuedBytes = 0;
+        for (const auto& queue : m_queues)
+        {
+            queuedPackets += queue->GetNPackets();
+            queuedBytes += queue->GetNBytes();
+        }
+        for (const auto& queueDisc : m_queueDiscs)
+        {
+            queuedPackets += queueDisc->GetNPackets();
+            queuedBytes += queueDisc->GetNBytes();
+        }
+
+        uint64_t timeMs = Simulator::Now().GetMilliSeconds();
+        int64_t rlcBytes = 0;
+        uint32_t rlcBearers = 0;
+        for (const auto& [id, bytes] : m_rlcQueues.GetBearerBytes())
+        {
+            rlcBearers++;
+            if (bytes > 0)
+            {
+                rlcBytes += bytes;
+                m_bearerCsv << timeMs << "," << std::get<0>(id) << "," << std::get<1>(id) << ","
+                            << +std::get<2>(id) << "," << bytes << "\n";
+            }
+        }
+
+        uint64_t rssKb = MetricsExporter::GetResidentBytes() / 1024;
+        uint64_t pending = CountingMapScheduler::GetPending();
+        m_csv << timeMs << "," << rssKb << "," << GetHeapBytes() / 1024 << "," << pending << ","
+              << Simulator::GetEventCount() << "," << m_monitor->GetFlowStats().size() << ","
+              << queuedPackets << "," << queuedBytes << "," << rlcBytes << "," << rlcBearers
+              << "\n";
+
+        m_samples++;
+        if (rssKb > m_peakRssKb)
+        {
+            m_peakRssKb = rssKb;
+            m_peakRssTimeMs = timeMs;
+        }
+        m_maxPending = std::max(m_maxPending, pending);
+        m_maxQueuedPackets = std::max(m_maxQueuedPackets, queuedPackets);
+        Simulator::Schedule(m_interval, &MemoryCensus::Sample, this);
+    }
+
+    /// Bytes allocated through malloc and still in use (0 where not available)
+    static uint64_t GetHeapBytes()
+    {
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 33)
+        return mallinfo2().uordblks;
+#else
+        return 0;
+#endif
+    }
+
+    std::ofstream m_csv;
+    std::ofstream m_bearerCsv;
+    Ptr<FlowMonitor> m_monitor;
+    const RlcQueueMonitor& m_rlcQueues;
+    Time m_interval;
+    std::vector<Ptr<QueueBase>> m_queues;
+    std::vector<Ptr<QueueDisc>> m_queueDiscs;
+
+    uint64_t m_samples{0};
+    uint64_t m_peakRssKb{0};
+    uint64_t m_peakRssTimeMs{0};
+    uint64_t m_maxPending{0};
+    uint64_t m_maxQueuedPackets{0};
+};
+
+/**
+ * One environment of a pool of DRL environments (env_pool.py), stepped in
+ * lockstep with the others through a POSIX shared memory segment that the
+ * pool creates. The segment holds a header, one 64-byte control line per
+ * environment, then the observations of all the environments as a single
+ * float32 [environments x OBS_DIM] array, then the actions as an int32
+ * [environments x ACT_DIM] array, each array starting on a 64-byte boundary.
+ *
+ * At every step boundary the environment writes its observation row and
+ * publishes the step number in its control line. It then waits until the pool
+ * publishes the same number for the action, and caps the PRBs of every slice
+ * by notching the RBGs above the action out of the slice BWP on all gNBs
+ * (SLICE_LIMIT layer of the NotchedRbgMasks). A negative action lifts the cap.
+ * Each side spins briefly on the other's step word, then sleeps on it as a
+ * futex, so a step costs a cache line transfer and a wake-up each way, and a
+ * waiting environment does not take a core from the others. The environment
+ * stops the simulation when the pool closes or exits.
+ */
+class SharedMemoryEnv
+{
+  public:
+    static constexpr uint32_t MAGIC = 0x4e524550; // "NREP"
+    static constexpr uint32_t VERSION = 1;
+    /// Per slice: throughput (Mbps), mean delay (ms), received packets, RLC bytes, PRBs
+    static constexpr uint32_t OBS_PER_SLICE = 5;
+    static constexpr uint32_t NUM_SLICES = 3; //!< voice, video, gaming
+    static constexpr uint32_t OBS_DIM = OBS_PER_SLICE * NUM_SLICES;
+    static constexpr uint32_t ACT_DIM = NUM_SLICES;
 
-using namespace ns3;
+    SharedMemoryEnv(const std::string& name,
+                    uint32_t index,
+                    Time period,
+                    NotchedRbgMasks& masks,
+                    const RlcQueueMonitor& queues)
+        : m_period(period),
+          m_masks(masks),
+          m_queues(queues),
+          m_slices(NUM_SLICES)
+    {
+        std::string path = name.rfind('/', 0) == 0 ? name : "/" + name;
+        int fd = shm_open(path.c_str(), O_RDWR, 0);
+        NS_ABORT_MSG_IF(fd < 0, "Cannot open the environment pool segment " << path);
+        struct stat st;
+        fstat(fd, &st);
+        m_size = st.st_size;
+        void* base = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        NS_ABORT_MSG_IF(base == MAP_FAILED, "Cannot map the environment pool segment " << path);
+        m_base = static_cast<uint8_t*>(base);
 
-NS_LOG_COMPONENT_DEFINE("3gppChannelNumsFdm");
+        m_header = reinterpret_cast<Header*>(m_base);
+        uint32_t numEnvs = m_header->numEnvs;
+        NS_ABORT_MSG_IF(m_size < sizeof(Header) || m_header->magic != MAGIC ||
+                            m_header->version != VERSION || m_header->obsDim != OBS_DIM ||
+                            m_header->actDim != ACT_DIM ||
+                            m_size < ActionOffset(numEnvs) + numEnvs * ACT_DIM * sizeof(int32_t),
+                        "The segment " << path << " is not an environment pool of this version");
+        NS_ABORT_MSG_IF(index >= numEnvs,
+                        "Environment " << index << " outside a pool of " << numEnvs);
+        m_index = index;
+        m_control = reinterpret_cast<Control*>(m_base + CONTROL_OFFSET) + index;
+        m_obs = reinterpret_cast<float*>(m_base + ObsOffset(numEnvs)) + index * OBS_DIM;
+        m_action = reinterpret_cast<int32_t*>(m_base + ActionOffset(numEnvs)) + index * ACT_DIM;
+    }
 
-int
-main(int argc, char* argv[])
+    ~SharedMemoryEnv()
+    {
+        // A run stopped early (steady state, closed pool) still ends the episode
+        if (!m_done)
+        {
+            m_control->done = 1;
+            Publish();
+        }
+        munmap(m_base, m_size);
+    }
+
+    /// Let the actions of slice cap the PRBs of the BWP bwpId of every gNB, DL or UL
+    void AddSlice(size_t slice, const NetDeviceContainer& gnbNetDev, uint16_t bwpId, bool dl)
+    {
+        for (uint32_t i = 0; i < gnbNetDev.GetN(); ++i)
+        {
+            Target target;
+            target.scheduler =
+                DynamicCast<NrMacSchedulerNs3>(NrHelper::GetScheduler(gnbNetDev.Get(i), bwpId));
+            target.dl = dl;
+            target.rbPerRbg = NrHelper::GetGnbMac(gnbNetDev.Get(i), bwpId)->GetNumRbPerRbg();
+            target.numRbg = NrHelper::GetGnbPhy(gnbNetDev.Get(i), bwpId)->GetRbNum() /
+                            target.rbPerRbg;
+            if (m_slices[slice].targets.empty())
+            {
+                m_slices[slice].prbs = target.numRbg * target.rbPerRbg;
+            }
+            m_slices[slice].targets.push_back(target);
+        }
+    }
+
+    /// Count the packets received by the UDP servers, per slice of their port
+    void ConnectServers(const ApplicationContainer& servers,
+                        const std::map<uint16_t, std::string>& sliceByPort)
+    {
+        const std::vector<std::string>& slices = m_queues.GetSlices();
+        for (uint32_t i = 0; i < servers.GetN(); ++i)
+        {
+            UintegerValue port;
+            servers.Get(i)->GetAttribute("Port", port);
+            auto slice = sliceByPort.find(port.Get());
+            if (slice == sliceByPort.end())
+            {
+                continue;
+            }
+            size_t index = std::find(slices.begin(), slices.end(), slice->second) - slices.begin();
+            if (index < NUM_SLICES)
+            {
+                servers.Get(i)->TraceConnectWithoutContext(
+                    "Rx",
+                    MakeBoundCallback(&SharedMemoryEnv::NotifyRx, &m_slices[index]));
+            }
+        }
+    }
+
+    /// First observation now, the last one a step before stopTime
+    void Start(Time stopTime)
+    {
+        m_stopTime = stopTime;
+        for (Slice& slice : m_slices)
+        {
+            slice.rxPackets = 0;
+            slice.rxBytes = 0;
+            slice.delayNs = 0;
+        }
+        Step();
+    }
+
+    void WriteSummary(std::ostream& os) const
+    {
+        os << "\n  DRL environment " << m_index << " of " << m_header->numEnvs << ": " << m_step
+           << " steps of " << m_period.GetMilliSeconds() << " ms, mean wait for the action "
+           << (m_step > 0 ? m_waitNs / 1e3 / m_step : 0.0) << " us\n";
+    }
+
+  private:
+    static constexpr size_t CONTROL_OFFSET = 64;
+
+    struct Header
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t numEnvs;
+        uint32_t obsDim;
+        uint32_t actDim;
+        int32_t poolPid;
+        uint32_t closed; //!< set by the pool when it shuts down
+    };
+
+    struct alignas(64) Control
+    {
+        uint64_t actionStep; //!< written by the pool: step of the published action
+        uint64_t obsStep;    //!< written by the environment: step of the published observation
+        double timeS;        //!< simulated time of the observation
+        uint32_t done;       //!< no action follows this observation
+    };
+
+    /// Both sides wait on the step words as 32-bit futexes, i.e. on their low half
+    static uint32_t* LowHalf(uint64_t* word)
+    {
+        return reinterpret_cast<uint32_t*>(word) + (std::endian::native == std::endian::big);
+    }
+
+    struct Target
+    {
+        Ptr<NrMacSchedulerNs3> scheduler;
+        bool dl;
+        uint32_t rbPerRbg;
+        uint32_t numRbg;
+    };
+
+    struct Slice
+    {
+        uint64_t rxPackets{0};
+        uint64_t rxBytes{0};
+        uint64_t delayNs{0};
+        std::vector<Target> targets;
+        int32_t action{-1}; //!< last applied action, negative for no cap
+        uint32_t prbs{0};   //!< PRBs usable under the current action, on the first gNB
+    };
+
+    static size_t ObsOffset(uint32_t numEnvs)
+    {
+        return CONTROL_OFFSET + numEnvs * sizeof(Control);
+    }
+
+    static size_t ActionOffset(uint32_t numEnvs)
+    {
+        size_t obsEnd = ObsOffset(numEnvs) + numEnvs * OBS_DIM * sizeof(float);
+        return (obsEnd + 63) / 64 * 64;
+    }
+
+    static void NotifyRx(Slice* slice, Ptr<const Packet> packet)
+    {
+        SeqTsHeader seqTs;
+        packet->PeekHeader(seqTs);
+        slice->rxPackets++;
+        slice->rxBytes += packet->GetSize();
+        slice->delayNs += (Simulator::Now() - seqTs.GetTs()).GetNanoSeconds();
+    }
+
+    void Step()
+    {
+        float* obs = m_obs;
+        for (size_t i = 0; i < NUM_SLICES; ++i, obs += OBS_PER_SLICE)
+        {
+            Slice& slice = m_slices[i];
+            obs[0] = slice.rxBytes * 8 / m_period.GetSeconds() / 1e6;
+            obs[1] = slice.rxPackets > 0 ? slice.delayNs / 1e6 / slice.rxPackets : 0.0;
+            obs[2] = slice.rxPackets;
+            obs[3] = m_queues.GetSliceBytes(i);
+            obs[4] = slice.prbs;
+            slice.rxPackets = 0;
+            slice.rxBytes = 0;
+            slice.delayNs = 0;
+        }
+        m_control->timeS = Simulator::Now().GetSeconds();
+        m_done = Simulator::Now() + m_period >= m_stopTime;
+        m_control->done = m_done;
+        Publish();
+        if (m_done || !WaitForAction())
+        {
+            return;
+        }
+        Apply();
+        Simulator::Schedule(m_period, &SharedMemoryEnv::Step, this);
+    }
+
+    /// Hand the observation written so far to the pool
+    void Publish()
+    {
+        std::atomic_ref<uint64_t>(m_control->obsStep).store(++m_step, std::memory_order_release);
+        syscall(SYS_futex, LowHalf(&m_control->obsStep), FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);
+    }
+
+    /**
+     * Spin for a short while, then sleep on the step word (a futex on its low
+     * half), until the action of the current step; false if the pool is gone.
+     */
+    bool WaitForAction()
+    {
+        std::atomic_ref<uint64_t> actionStep(m_control->actionStep);
+        auto start = std::chrono::steady_clock::now();
+        uint64_t seen;
+        for (uint32_t spins = 0; (seen = actionStep.load(std::memory_order_acquire)) < m_step;
+             ++spins)
+        {
+            if (spins < SPINS_BEFORE_SLEEP)
+            {
+#if defined(__x86_64__) || defined(__i386__)
+                __builtin_ia32_pause();
+#endif
+                continue;
+            }
+            if (PoolGone())
+            {
+                std::cerr << "Environment pool closed, stopping environment " << m_index
+                          << std::endl;
+                Simulator::Stop();
+                return false;
+            }
+            // Woken by the pool, or after the timeout to check that it is still there
+            timespec timeout{0, 100000000};
+            syscall(SYS_futex,
+                    LowHalf(&m_control->actionStep),
+                    FUTEX_WAIT,
+                    static_cast<uint32_t>(seen),
+                    &timeout,
+                    nullptr,
+                    0);
+        }
+        m_waitNs += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+        return true;
+    }
+
+    bool PoolGone() const
+    {
+        return std::atomic_ref<uint32_t>(m_header->closed).load(std::memory_order_acquire) != 0 ||
+               (kill(m_header->poolPid, 0) != 0 && errno == ESRCH);
+    }
+
+    /// Cap every slice to the PRBs of its action, rounded up to whole RBGs
+    void Apply()
+    {
+        for (size_t i = 0; i < NUM_SLICES; ++i)
+        {
+            Slice& slice = m_slices[i];
+            int32_t action = m_action[i];
+            if (action == slice.action)
+            {
+                continue;
+            }
+            slice.action = action;
+            for (size_t t = 0; t < slice.targets.size(); ++t)
+            {
+                const Target& target = slice.targets[t];
+                uint32_t rbgs = target.numRbg;
+                if (action >= 0)
+                {
+                    rbgs = std::clamp<uint32_t>((action + target.rbPerRbg - 1) / target.rbPerRbg,
+                                                1,
+                                                target.numRbg);
+                }
+                std::vector<uint8_t> mask(target.numRbg, 0);
+                std::fill(mask.begin(), mask.begin() + rbgs, 1);
+                if (target.dl)
+                {
+                    m_masks.SetDl(target.scheduler, NotchedRbgMasks::SLICE_LIMIT, mask);
+                }
+                else
+                {
+                    m_masks.SetUl(target.scheduler, NotchedRbgMasks::SLICE_LIMIT, mask);
+                }
+                if (t == 0)
+                {
+                    slice.prbs = rbgs * target.rbPerRbg;
+                }
+            }
+        }
+    }
+
+    static constexpr uint32_t SPINS_BEFORE_SLEEP = 1024;
+
+    Time m_period;
+    NotchedRbgMasks& m_masks;
+    const RlcQueueMonitor& m_queues;
+    std::vector<Slice> m_slices;
+    uint8_t* m_base{nullptr};
+    size_t m_size{0};
+    Header* m_header{nullptr};
+    Control* m_control{nullptr};
+    float* m_obs{nullptr};
+    int32_t* m_action{nullptr};
+    uint32_t m_index{0};
+
+    Time m_stopTime;
+    uint64_t m_step{0};
+    bool m_done{false};
+    uint64_t m_waitNs{0};
+};
+
+/**
+ * One simulation, configured by its command line (and the configuration file
+ * it names) as a process launch would be. Returns the exit status.
+ */
+static int
+RunScenario(int argc, char* argv[])
 {
     uint16_t gNbNum = 4;
     uint16_t ueNum = 4;
@@ -35,6 +3289,7 @@ main(int argc, char* argv[])
     double bandwidthBand1 = 0.0; // will be computed from PRBs
     double centralFrequencyBand2 = 28.2e9;
     double bandwidthBand2 = 0.0; // will be computed from PRBs
+    double centralFrequencyBand3 = 28.4e9; // mMTC band, only with mmtcDevices
     double totalTxPower = 4;
     std::string simTag = "default";
     std::string outputDir = "./";
@@ -50,6 +3305,80 @@ main(int argc, char* argv[])
     // Reference numerology to convert PRB -> Hz (mu: 0 -> 15 kHz)
     uint32_t referenceNumerology = 0;
 
+    // Interval of the periodic flow statistics report (0 disables it)
+    uint32_t flowStatsIntervalMs = 0;
+
+    // Steady-state detection: batch length (0 disables it), target relative
+    // half-width of the 95% confidence intervals and minimum number of batches.
+    // When enabled, simTimeMs is the ceiling of the simulation time.
+    uint32_t convergenceBatchMs = 0;
+    double convergencePrecision = 0.05;
+    uint32_t convergenceMinBatches = 10;
+
+    // Per-slot PRB utilisation trace: "off", "slot" (one record per slot) or
+    // "ms" (slots summed per millisecond)
+    std::string slotStatsMode = "off";
+
+    // Per-slice split of the packet latency into core, PDCP, queueing and
+    // scheduling, HARQ and air components
+    bool latencyDecomposition = false;
+
+    // Configured-grant UL for the gaming bearer: grant period (0 uses the
+    // packet interval of the gaming flow)
+    bool configuredGrantGaming = false;
+    uint32_t configuredGrantPeriodUs = 0;
+
+    // URLLC (voice) in the eMBB (video) BWP, scheduled ahead of it in every slot
+    // by the QoS scheduler, instead of in a BWP of its own; optionally in
+    // mini-slots of 2, 4 or 7 symbols (0: slot-based), punctured into the eMBB
+    // TBs in flight
+    bool urllcSharedBwp = false;
+    uint32_t urllcMiniSlotSymbols = 0;
+    bool urllcPreemption = false;
+
+    // Aggregated mMTC load: devices per cell (0 disables it), report interval
+    // of every device, report size and RACH occasion period
+    uint32_t mmtcDevices = 0;
+    uint32_t mmtcReportIntervalMs = 10000;
+    uint32_t mmtcPacketSize = 32;
+    uint32_t mmtcRachPeriodMs = 5;
+
+    // Fluid DL background load on the eMBB BWP: offered rate per cell (0
+    // disables it), gNB indices carrying it (empty: all) and spectral
+    // efficiency of the background transmissions
+    double fluidBackgroundMbps = 0.0;
+    std::string fluidBackgroundCells = "";
+    double fluidBackgroundEfficiency = 2.0;
+
+    // Interference-only gNBs on a ring around the deployment: number (0
+    // disables them), ring radius and mean fraction of busy RBGs
+    uint32_t interfererGnbs = 0;
+    double interfererRadius = 50.0;
+    double interfererLoad = 0.5;
+
+    // Tabulated SINR to BLER mapping for first transmissions: table file
+    // (empty: built in memory every run) and validation interval in TBs
+    bool blerTable = false;
+    std::string blerTableFile = "";
+    uint32_t blerValidationInterval = 1000;
+
+    // Loopback port of the live Prometheus metrics (0: off) and their sampling
+    // interval in simulated time
+    uint16_t metricsPort = 0;
+    uint32_t metricsIntervalMs = 10;
+
+    // Interval of the memory census (0: off), in simulated time
+    uint32_t memoryCensusMs = 0;
+
+    // Shared memory segment of a DRL environment pool (empty: off), index of
+    // this environment in the pool and simulated time of one step
+    std::string envShm = "";
+    uint32_t envIndex = 0;
+    uint32_t envStepMs = 10;
+
+    // File of scenario command lines, run one after the other (handled by main)
+    std::string batchFile = "";
+
     CommandLine cmd(__FILE__);
 
     cmd.AddValue("packetSizeVideo",
@@ -82,6 +3411,9 @@ main(int argc, char* argv[])
     cmd.AddValue("centralFrequencyBand2",
                  "The system frequency to be used in band 2",
                  centralFrequencyBand2);
+    cmd.AddValue("centralFrequencyBand3",
+                 "The system frequency to be used in band 3 (mMTC, with mmtcDevices)",
+                 centralFrequencyBand3);
     cmd.AddValue("totalTxPower",
                  "total tx power that will be proportionally assigned to"
                  " bands, CCs and bandwidth parts depending on each BWP bandwidth ",
@@ -96,9 +3428,110 @@ main(int argc, char* argv[])
     cmd.AddValue("prbVideo", "Number of PRBs allocated to Video traffic (BWP1 in Band 2)", prbVideo);
     cmd.AddValue("prbGaming", "Number of PRBs allocated to Gaming traffic (BWP2 in Band 2)", prbGaming);
     cmd.AddValue("referenceNumerology", "Reference numerology mu for PRB size (0 -> 15 kHz)", referenceNumerology);
+    cmd.AddValue("flowStatsIntervalMs",
+                 "Interval of the periodic per-flow/per-slice statistics report, 0 to disable",
+                 flowStatsIntervalMs);
+    cmd.AddValue("convergenceBatchMs",
+                 "Batch length of the steady-state detection, 0 to disable early termination",
+                 convergenceBatchMs);
+    cmd.AddValue("convergencePrecision",
+                 "Target CI half-width, relative to the mean, of per-slice throughput and delay",
+                 convergencePrecision);
+    cmd.AddValue("convergenceMinBatches",
+                 "Minimum number of batches before the simulation can be stopped",
+                 convergenceMinBatches);
+    cmd.AddValue("slotStatsMode",
+                 "Per-slot PRB utilisation trace: off, slot (one record per slot) or ms",
+                 slotStatsMode);
+    cmd.AddValue("latencyDecomposition",
+                 "If true, splits the per-slice packet latency into core, PDCP, queueing and "
+                 "scheduling, HARQ and air components",
+                 latencyDecomposition);
+    cmd.AddValue("configuredGrantGaming",
+                 "If true, the gaming bearer gets periodic UL grants without scheduling requests",
+                 configuredGrantGaming);
+    cmd.AddValue("configuredGrantPeriodUs",
+                 "Period of the configured UL grants of the gaming bearer "
+                 "(0: gaming packet interval)",
+                 configuredGrantPeriodUs);
+    cmd.AddValue("urllcSharedBwp",
+                 "If true, voice shares the video BWP and is scheduled ahead of it (QoS TDMA)",
+                 urllcSharedBwp);
+    cmd.AddValue("urllcMiniSlotSymbols",
+                 "With urllcSharedBwp, length of the voice mini-slots: 2, 4 or 7 symbols "
+                 "(0: slot-based)",
+                 urllcMiniSlotSymbols);
+    cmd.AddValue("urllcPreemption",
+                 "With urllcMiniSlotSymbols, the voice mini-slots puncture the video TBs in "
+                 "flight, which HARQ retransmits",
+                 urllcPreemption);
+    cmd.AddValue("mmtcDevices",
+                 "Number of mMTC devices per cell, modelled as one aggregated source (0: none)",
+                 mmtcDevices);
+    cmd.AddValue("mmtcReportIntervalMs",
+                 "Report interval of every mMTC device",
+                 mmtcReportIntervalMs);
+    cmd.AddValue("mmtcPacketSize", "Size in bytes of an mMTC report", mmtcPacketSize);
+    cmd.AddValue("mmtcRachPeriodMs",
+                 "Period of the RACH occasions the mMTC devices contend in",
+                 mmtcRachPeriodMs);
+    cmd.AddValue("fluidBackgroundMbps",
+                 "DL background load per cell, modelled as a fluid on the video BWP (0: none)",
+                 fluidBackgroundMbps);
+    cmd.AddValue("fluidBackgroundCells",
+                 "Comma-separated gNB indices with fluid background load (empty: all)",
+                 fluidBackgroundCells);
+    cmd.AddValue("fluidBackgroundEfficiency",
+                 "Spectral efficiency (bit/s/Hz) of the fluid background transmissions",
+                 fluidBackgroundEfficiency);
+    cmd.AddValue("interfererGnbs",
+                 "Number of interference-only gNBs on a ring around the deployment",
+                 interfererGnbs);
+    cmd.AddValue("interfererRadius",
+                 "Radius in meters of the ring of interference-only gNBs",
+                 interfererRadius);
+    cmd.AddValue("interfererLoad",
+                 "Mean fraction of busy RBGs of the interference-only gNBs",
+                 interfererLoad);
+    cmd.AddValue("blerTable",
+                 "If true, first transmissions take their BLER from a table of the NrEesmIrT1 "
+                 "model",
+                 blerTable);
+    cmd.AddValue("blerTableFile",
+                 "File the BLER table is mapped from, or written to if it does not exist",
+                 blerTableFile);
+    cmd.AddValue("blerValidationInterval",
+                 "Check one tabulated TB in this many against the reference model (0: never)",
+                 blerValidationInterval);
+    cmd.AddValue("metricsPort",
+                 "Loopback port serving live metrics in the Prometheus text format (0: off)",
+                 metricsPort);
+    cmd.AddValue("metricsIntervalMs",
+                 "Simulated time between two updates of the live metrics gauges",
+                 metricsIntervalMs);
+    cmd.AddValue("memoryCensusMs",
+                 "Interval of the memory footprint and object census samples (0: off)",
+                 memoryCensusMs);
+    cmd.AddValue("envShm",
+                 "Shared memory segment of the DRL environment pool to step in (empty: off)",
+                 envShm);
+    cmd.AddValue("envIndex", "Index of this environment in the DRL environment pool", envIndex);
+    cmd.AddValue("envStepMs",
+                 "Simulated time between two observations of the DRL environment",
+                 envStepMs);
+    cmd.AddValue("batchFile",
+                 "File with one scenario command line per line, run in turn in this process",
+                 batchFile);
 // ----------- Load Configuration From File ------------
 std::string configFile = "config.txt";
 cmd.AddValue("configFile", "Path to configuration text file", configFile);
+// The file is read before cmd.Parse(), so pick the option up from argv here
+for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg.rfind("--configFile=", 0) == 0) {
+        configFile = arg.substr(std::string("--configFile=").size());
+    }
+}
 
 std::map<std::string, std::string> configMap;
 std::ifstream cfg(configFile);
@@ -109,6 +3542,11 @@ if (cfg.is_open()) {
         std::istringstream iss(line);
         std::string key, value;
         if (std::getline(iss, key, '=') && std::getline(iss, value)) {
+            // config.txt uses "key=value"; strip any blanks around both all the same
+            key.erase(0, key.find_first_not_of(" \t"));
+            key.erase(key.find_last_not_of(" \t\r") + 1);
+            value.erase(0, value.find_first_not_of(" \t"));
+            value.erase(value.find_last_not_of(" \t\r") + 1);
             configMap[key] = value;
         }
     }
@@ -126,10 +3564,41 @@ ueNum = std::stoi(getConf("ueNum", std::to_string(ueNum)));
 
 centralFrequencyBand1 = std::stod(getConf("centralFrequencyBand1", std::to_string(centralFrequencyBand1)));
 centralFrequencyBand2 = std::stod(getConf("centralFrequencyBand2", std::to_string(centralFrequencyBand2)));
+centralFrequencyBand3 = std::stod(getConf("centralFrequencyBand3", std::to_string(centralFrequencyBand3)));
 referenceNumerology = std::stoi(getConf("referenceNumerology", std::to_string(referenceNumerology)));
 
 simTimeMs = std::stoi(getConf("simTimeMs", std::to_string(simTimeMs)));
 udpAppStartTimeMs = std::stoi(getConf("udpAppStartTimeMs", std::to_string(udpAppStartTimeMs)));
+flowStatsIntervalMs = std::stoi(getConf("flowStatsIntervalMs", std::to_string(flowStatsIntervalMs)));
+convergenceBatchMs = std::stoi(getConf("convergenceBatchMs", std::to_string(convergenceBatchMs)));
+convergencePrecision = std::stod(getConf("convergencePrecision", std::to_string(convergencePrecision)));
+convergenceMinBatches = std::stoi(getConf("convergenceMinBatches", std::to_string(convergenceMinBatches)));
+slotStatsMode = getConf("slotStatsMode", slotStatsMode);
+latencyDecomposition = std::stoi(getConf("latencyDecomposition", std::to_string(latencyDecomposition))) != 0;
+configuredGrantGaming = std::stoi(getConf("configuredGrantGaming", std::to_string(configuredGrantGaming))) != 0;
+configuredGrantPeriodUs = std::stoi(getConf("configuredGrantPeriodUs", std::to_string(configuredGrantPeriodUs)));
+urllcSharedBwp = std::stoi(getConf("urllcSharedBwp", std::to_string(urllcSharedBwp))) != 0;
+urllcMiniSlotSymbols = std::stoi(getConf("urllcMiniSlotSymbols", std::to_string(urllcMiniSlotSymbols)));
+urllcPreemption = std::stoi(getConf("urllcPreemption", std::to_string(urllcPreemption))) != 0;
+mmtcDevices = std::stoi(getConf("mmtcDevices", std::to_string(mmtcDevices)));
+mmtcReportIntervalMs = std::stoi(getConf("mmtcReportIntervalMs", std::to_string(mmtcReportIntervalMs)));
+mmtcPacketSize = std::stoi(getConf("mmtcPacketSize", std::to_string(mmtcPacketSize)));
+mmtcRachPeriodMs = std::stoi(getConf("mmtcRachPeriodMs", std::to_string(mmtcRachPeriodMs)));
+fluidBackgroundMbps = std::stod(getConf("fluidBackgroundMbps", std::to_string(fluidBackgroundMbps)));
+fluidBackgroundCells = getConf("fluidBackgroundCells", fluidBackgroundCells);
+fluidBackgroundEfficiency = std::stod(getConf("fluidBackgroundEfficiency", std::to_string(fluidBackgroundEfficiency)));
+interfererGnbs = std::stoi(getConf("interfererGnbs", std::to_string(interfererGnbs)));
+interfererRadius = std::stod(getConf("interfererRadius", std::to_string(interfererRadius)));
+interfererLoad = std::stod(getConf("interfererLoad", std::to_string(interfererLoad)));
+blerTable = std::stoi(getConf("blerTable", std::to_string(blerTable))) != 0;
+blerTableFile = getConf("blerTableFile", blerTableFile);
+blerValidationInterval = std::stoi(getConf("blerValidationInterval", std::to_string(blerValidationInterval)));
+metricsPort = std::stoi(getConf("metricsPort", std::to_string(metricsPort)));
+metricsIntervalMs = std::stoi(getConf("metricsIntervalMs", std::to_string(metricsIntervalMs)));
+memoryCensusMs = std::stoi(getConf("memoryCensusMs", std::to_string(memoryCensusMs)));
+envShm = getConf("envShm", envShm);
+envIndex = std::stoi(getConf("envIndex", std::to_string(envIndex)));
+envStepMs = std::stoi(getConf("envStepMs", std::to_string(envStepMs)));
 
 // Traffic slice PRBs
 uint32_t prbUrllc = std::stoi(getConf("prbUrllc", "50"));
@@ -140,13 +3609,35 @@ uint32_t prbMmtc = std::stoi(getConf("prbMmtc", "50"));
 
     NS_ABORT_IF(centralFrequencyBand1 > 100e9);
     NS_ABORT_IF(centralFrequencyBand2 > 100e9);
+    NS_ABORT_IF(centralFrequencyBand3 > 100e9);
+    NS_ABORT_MSG_IF(slotStatsMode != "off" && slotStatsMode != "slot" && slotStatsMode != "ms",
+                    "slotStatsMode must be off, slot or ms");
+    NS_ABORT_MSG_IF(urllcSharedBwp && !envShm.empty(),
+                    "urllcSharedBwp can't be used with envShm: the voice action has no BWP of "
+                    "its own to cap");
+    NS_ABORT_MSG_IF(ueNum != gNbNum, "ueNum must equal gNbNum: UE i is attached to gNB i");
+    NS_ABORT_MSG_IF(urllcMiniSlotSymbols != 0 && urllcMiniSlotSymbols != 2 &&
+                        urllcMiniSlotSymbols != 4 && urllcMiniSlotSymbols != 7,
+                    "urllcMiniSlotSymbols must be 0, 2, 4 or 7");
+    NS_ABORT_MSG_IF(urllcMiniSlotSymbols > 0 && !urllcSharedBwp,
+                    "urllcMiniSlotSymbols needs urllcSharedBwp");
+    NS_ABORT_MSG_IF(urllcPreemption && urllcMiniSlotSymbols == 0,
+                    "urllcPreemption needs urllcMiniSlotSymbols");
 
     Config::SetDefault("ns3::NrRlcUm::MaxTxBufferSize", UintegerValue(999999999));
 
+    if (memoryCensusMs > 0)
+    {
+        // Default scheduler, with a count of the pending events for the census
+        ObjectFactory scheduler;
+        scheduler.SetTypeId(CountingMapScheduler::GetTypeId());
+        Simulator::SetScheduler(scheduler);
+    }
+
     int64_t randomStream = 1;
 
     GridScenarioHelper gridScenario;
-    gridScenario.SetRows(gNbNum / 2);
+    gridScenario.SetRows(std::max(1, gNbNum / 2));
     gridScenario.SetColumns(gNbNum);
     gridScenario.SetHorizontalBsDistance(5.0);
     gridScenario.SetBsHeight(10.0);
@@ -167,6 +3658,14 @@ uint32_t prbMmtc = std::stoi(getConf("prbMmtc", "50"));
 
     // Put the pointers inside nrHelper
     nrHelper->SetBeamformingHelper(idealBeamformingHelper);
+
+    if (blerTable)
+    {
+        TabulatedEesmIrT1::SetTableFile(blerTableFile);
+        TabulatedEesmIrT1::SetValidationInterval(blerValidationInterval);
+        nrHelper->SetDlErrorModel("ns3::TabulatedEesmIrT1");
+        nrHelper->SetUlErrorModel("ns3::TabulatedEesmIrT1");
+    }
     nrHelper->SetEpcHelper(nrEpcHelper);
 
     // Create the spectrum channel
@@ -184,19 +3683,30 @@ uint32_t prbMmtc = std::stoi(getConf("prbMmtc", "50"));
     double scsHz = 15000.0 * std::pow(2.0, static_cast<double>(referenceNumerology));
     double bandwidthPerPrbHz = 12.0 * scsHz; 
 
-    // Bandwidth 1 corresponds to BWP0 (Voice)
-    bandwidthBand1 = static_cast<double>(prbVoice) * bandwidthPerPrbHz;
+    // Bandwidth 1 corresponds to BWP0 (Voice). With voice in the video BWP,
+    // BWP0 only carries the default bearer and is kept to a few PRBs
+    const uint32_t prbBwp0 = urllcSharedBwp ? std::min<uint32_t>(prbVoice, 4) : prbVoice;
+    bandwidthBand1 = static_cast<double>(prbBwp0) * bandwidthPerPrbHz;
 
     // Bandwidth 2 corresponds to BWP1 (Video) + BWP2 (Gaming)
     bandwidthBand2 = static_cast<double>(prbVideo + prbGaming) * bandwidthPerPrbHz;
 
     // Print configured bandwidths for verification
     std::cout << "Configured Voice BWP (Band 1) bandwidth: " << bandwidthBand1 / 1e6 << " MHz ("
-              << prbVoice << " PRBs, numerology mu=" << referenceNumerology << ")" << std::endl;
+              << prbBwp0 << " PRBs, numerology mu=" << referenceNumerology << ")" << std::endl;
     std::cout << "Configured Video/Gaming BWP (Band 2) total bandwidth: " << bandwidthBand2 / 1e6
               << " MHz (" << prbVideo + prbGaming << " PRBs total, numerology mu=" << referenceNumerology
               << ")" << std::endl;
 
+    // Bandwidth 3 corresponds to BWP3 (mMTC), which only exists with mMTC devices
+    double bandwidthBand3 = static_cast<double>(prbMmtc) * bandwidthPerPrbHz;
+    if (mmtcDevices > 0)
+    {
+        std::cout << "Configured mMTC BWP (Band 3) bandwidth: " << bandwidthBand3 / 1e6
+                  << " MHz (" << prbMmtc << " PRBs, numerology mu=" << referenceNumerology << ")"
+                  << std::endl;
+    }
+
     const uint8_t numCcPerBand = 1; // in this example, both bands have a single CC
 
     CcBwpCreator::SimpleOperationBandConf bandConfTdd(centralFrequencyBand1,
@@ -209,21 +3719,34 @@ uint32_t prbMmtc = std::stoi(getConf("prbMmtc", "50"));
 
     bandConfFdd.m_numBwp = 2; // Here, bandFdd will have 2 BWPs
 
+    CcBwpCreator::SimpleOperationBandConf bandConfMmtc(centralFrequencyBand3,
+                                                       bandwidthBand3,
+                                                       numCcPerBand);
+
     // make the operation bands using the configuration
     OperationBandInfo bandTdd = ccBwpCreator.CreateOperationBandContiguousCc(bandConfTdd);
     OperationBandInfo bandFdd = ccBwpCreator.CreateOperationBandContiguousCc(bandConfFdd);
-    // Create the same spectrum channel for both bands with different frequencies
-    channelHelper->AssignChannelsToBands({bandTdd, bandFdd});
+    OperationBandInfo bandMmtc;
+    std::vector<std::reference_wrapper<OperationBandInfo>> bands{bandTdd, bandFdd};
+    if (mmtcDevices > 0)
+    {
+        bandMmtc = ccBwpCreator.CreateOperationBandContiguousCc(bandConfMmtc);
+        bands.push_back(bandMmtc);
+    }
+    // Create the same spectrum channel for all bands with different frequencies
+    channelHelper->AssignChannelsToBands(bands);
 
     /*
      * The configured spectrum division is:
-     * |------------BandTdd--------------|--------------BandFdd---------------|
-     * |------------CC0------------------|--------------CC1-------------------|
-     * |------------BWP0-----------------|------BWP1-------|-------BWP2-------|
+     * |------------BandTdd--------------|--------------BandFdd---------------|---BandMmtc---|
+     * |------------CC0------------------|--------------CC1-------------------|-----CC2------|
+     * |------------BWP0-----------------|------BWP1-------|-------BWP2-------|-----BWP3-----|
      *
-     * We will configure BWP0 as TDD, BWP1 as FDD-DL, BWP2 as FDD-UL.
+     * We will configure BWP0 as TDD, BWP1 as FDD-DL, BWP2 as FDD-UL, and the
+     * mMTC BWP3, only present with mMTC devices, as TDD.
      */
-    allBwps = CcBwpCreator::GetAllBwps({bandTdd, bandFdd});
+    allBwps = CcBwpCreator::GetAllBwps(bands);
+    const uint32_t numBwps = bands.size() == 3 ? 4 : 3;
     // Beamforming method
     idealBeamformingHelper->SetAttribute("BeamformingMethod",
                                          TypeIdValue(DirectPathBeamforming::GetTypeId()));
@@ -248,14 +3771,33 @@ uint32_t prbMmtc = std::stoi(getConf("prbMmtc", "50"));
     uint32_t bwpIdForVoice = 0;
     uint32_t bwpIdForVideo = 1;
     uint32_t bwpIdForGaming = 2;
+    uint32_t bwpIdForMmtc = 3;
+
+    // Shared BWP: the TDMA scheduler gives every UE only the symbols it needs.
+    // SharedBwpScheduler keeps the default round robin on the other BWPs
+    if (urllcSharedBwp)
+    {
+        bwpIdForVoice = bwpIdForVideo;
+        nrHelper->SetSchedulerTypeId(SharedBwpScheduler::GetTypeId());
+    }
 
     nrHelper->SetGnbBwpManagerAlgorithmAttribute("GBR_CONV_VOICE", UintegerValue(bwpIdForVoice));
     nrHelper->SetGnbBwpManagerAlgorithmAttribute("GBR_CONV_VIDEO", UintegerValue(bwpIdForVideo));
     nrHelper->SetGnbBwpManagerAlgorithmAttribute("GBR_GAMING", UintegerValue(bwpIdForGaming));
+    if (mmtcDevices > 0)
+    {
+        nrHelper->SetGnbBwpManagerAlgorithmAttribute("NGBR_VIDEO_TCP_PREMIUM",
+                                                     UintegerValue(bwpIdForMmtc));
+    }
 
     nrHelper->SetUeBwpManagerAlgorithmAttribute("GBR_CONV_VOICE", UintegerValue(bwpIdForVoice));
     nrHelper->SetUeBwpManagerAlgorithmAttribute("GBR_CONV_VIDEO", UintegerValue(bwpIdForVideo));
     nrHelper->SetUeBwpManagerAlgorithmAttribute("GBR_GAMING", UintegerValue(bwpIdForGaming));
+    if (mmtcDevices > 0)
+    {
+        nrHelper->SetUeBwpManagerAlgorithmAttribute("NGBR_VIDEO_TCP_PREMIUM",
+                                                    UintegerValue(bwpIdForMmtc));
+    }
 
     NetDeviceContainer gnbNetDev =
         nrHelper->InstallGnbDevice(gridScenario.GetBaseStations(), allBwps);
@@ -265,99 +3807,63 @@ uint32_t prbMmtc = std::stoi(getConf("prbMmtc", "50"));
     randomStream += nrHelper->AssignStreams(gnbNetDev, randomStream);
     randomStream += nrHelper->AssignStreams(ueNetDev, randomStream);
 
-    NS_ASSERT(gnbNetDev.GetN() == 4);
-
-    // -------------- First GNB:
-
-    // BWP0, the TDD one
-    NrHelper::GetGnbPhy(gnbNetDev.Get(0), 0)->SetAttribute("Numerology", UintegerValue(0));
-    NrHelper::GetGnbPhy(gnbNetDev.Get(0), 0)
-        ->SetAttribute("Pattern", StringValue("F|F|F|F|F|F|F|F|F|F|"));
-    NrHelper::GetGnbPhy(gnbNetDev.Get(0), 0)->SetAttribute("TxPower", DoubleValue(4.0));
-
-    // BWP1, FDD-DL
-    NrHelper::GetGnbPhy(gnbNetDev.Get(0), 1)->SetAttribute("Numerology", UintegerValue(0));
-    NrHelper::GetGnbPhy(gnbNetDev.Get(0), 1)
-        ->SetAttribute("Pattern", StringValue("DL|DL|DL|DL|DL|DL|DL|DL|DL|DL|"));
-    NrHelper::GetGnbPhy(gnbNetDev.Get(0), 1)->SetAttribute("TxPower", DoubleValue(4.0));
-
-    // BWP2, FDD-UL
-    NrHelper::GetGnbPhy(gnbNetDev.Get(0), 2)->SetAttribute("Numerology", UintegerValue(0));
-    NrHelper::GetGnbPhy(gnbNetDev.Get(0), 2)
-        ->SetAttribute("Pattern", StringValue("UL|UL|UL|UL|UL|UL|UL|UL|UL|UL|"));
-    NrHelper::GetGnbPhy(gnbNetDev.Get(0), 2)->SetAttribute("TxPower", DoubleValue(0.0));
-
-    // Link the two FDD BWP:
-    NrHelper::GetBwpManagerGnb(gnbNetDev.Get(0))->SetOutputLink(2, 1);
-
-    // -------------- Second GNB:
-
-    // BWP0, the TDD one
-    NrHelper::GetGnbPhy(gnbNetDev.Get(1), 0)->SetAttribute("Numerology", UintegerValue(1));
-    NrHelper::GetGnbPhy(gnbNetDev.Get(1), 0)
-        ->SetAttribute("Pattern", StringValue("F|F|F|F|F|F|F|F|F|F|"));
-    NrHelper::GetGnbPhy(gnbNetDev.Get(1), 0)->SetAttribute("TxPower", DoubleValue(4.0));
-
-    // BWP1, FDD-DL
-    NrHelper::GetGnbPhy(gnbNetDev.Get(1), 1)->SetAttribute("Numerology", UintegerValue(1));
-    NrHelper::GetGnbPhy(gnbNetDev.Get(1), 1)
-        ->SetAttribute("Pattern", StringValue("DL|DL|DL|DL|DL|DL|DL|DL|DL|DL|"));
-    NrHelper::GetGnbPhy(gnbNetDev.Get(1), 1)->SetAttribute("TxPower", DoubleValue(4.0));
-
-    // BWP2, FDD-UL
-    NrHelper::GetGnbPhy(gnbNetDev.Get(1), 2)->SetAttribute("Numerology", UintegerValue(1));
-    NrHelper::GetGnbPhy(gnbNetDev.Get(1), 2)
-        ->SetAttribute("Pattern", StringValue("UL|UL|UL|UL|UL|UL|UL|UL|UL|UL|"));
-    NrHelper::GetGnbPhy(gnbNetDev.Get(1), 2)->SetAttribute("TxPower", DoubleValue(0.0));
-
-    // Link the two FDD BWP:
-    NrHelper::GetBwpManagerGnb(gnbNetDev.Get(1))->SetOutputLink(2, 1);
-
-    // -------------- Third GNB:
-
-    // BWP0, the TDD one
-    NrHelper::GetGnbPhy(gnbNetDev.Get(2), 0)->SetAttribute("Numerology", UintegerValue(2));
-    NrHelper::GetGnbPhy(gnbNetDev.Get(2), 0)
-        ->SetAttribute("Pattern", StringValue("F|F|F|F|F|F|F|F|F|F|"));
-    NrHelper::GetGnbPhy(gnbNetDev.Get(2), 0)->SetAttribute("TxPower", DoubleValue(4.0));
-
-    // BWP1, FDD-DL
-    NrHelper::GetGnbPhy(gnbNetDev.Get(2), 1)->SetAttribute("Numerology", UintegerValue(2));
-    NrHelper::GetGnbPhy(gnbNetDev.Get(2), 1)
-        ->SetAttribute("Pattern", StringValue("DL|DL|DL|DL|DL|DL|DL|DL|DL|DL|"));
-    NrHelper::GetGnbPhy(gnbNetDev.Get(2), 1)->SetAttribute("TxPower", DoubleValue(4.0));
-
-    // BWP2, FDD-UL
-    NrHelper::GetGnbPhy(gnbNetDev.Get(2), 2)->SetAttribute("Numerology", UintegerValue(2));
-    NrHelper::GetGnbPhy(gnbNetDev.Get(2), 2)
-        ->SetAttribute("Pattern", StringValue("UL|UL|UL|UL|UL|UL|UL|UL|UL|UL|"));
-    NrHelper::GetGnbPhy(gnbNetDev.Get(2), 2)->SetAttribute("TxPower", DoubleValue(0.0));
-
-    // Link the two FDD BWP:
-    NrHelper::GetBwpManagerGnb(gnbNetDev.Get(2))->SetOutputLink(2, 1);
-
-    // -------------- Fourth GNB:
-
-    // BWP0, the TDD one
-    NrHelper::GetGnbPhy(gnbNetDev.Get(3), 0)->SetAttribute("Numerology", UintegerValue(3));
-    NrHelper::GetGnbPhy(gnbNetDev.Get(3), 0)
-        ->SetAttribute("Pattern", StringValue("F|F|F|F|F|F|F|F|F|F|"));
-    NrHelper::GetGnbPhy(gnbNetDev.Get(3), 0)->SetAttribute("TxPower", DoubleValue(4.0));
-
-    // BWP1, FDD-DL
-    NrHelper::GetGnbPhy(gnbNetDev.Get(3), 1)->SetAttribute("Numerology", UintegerValue(3));
-    NrHelper::GetGnbPhy(gnbNetDev.Get(3), 1)
-        ->SetAttribute("Pattern", StringValue("DL|DL|DL|DL|DL|DL|DL|DL|DL|DL|"));
-    NrHelper::GetGnbPhy(gnbNetDev.Get(3), 1)->SetAttribute("TxPower", DoubleValue(4.0));
-
-    // BWP2, FDD-UL
-    NrHelper::GetGnbPhy(gnbNetDev.Get(3), 2)->SetAttribute("Numerology", UintegerValue(3));
-    NrHelper::GetGnbPhy(gnbNetDev.Get(3), 2)
-        ->SetAttribute("Pattern", StringValue("UL|UL|UL|UL|UL|UL|UL|UL|UL|UL|"));
-    NrHelper::GetGnbPhy(gnbNetDev.Get(3), 2)->SetAttribute("TxPower", DoubleValue(0.0));
-
-    // Link the two FDD BWP:
-    NrHelper::GetBwpManagerGnb(gnbNetDev.Get(3))->SetOutputLink(2, 1);
+    /*
+     * Every gNB has BWP0 TDD, BWP1 FDD-DL and BWP2 FDD-UL, and BWP3 TDD with mMTC
+     * devices. The numerology of all its BWPs is the gNB index modulo 4, so the
+     * 4-gNB layout has one gNB of each numerology from 0 to 3.
+     */
+    for (uint32_t i = 0; i < gnbNetDev.GetN(); ++i)
+    {
+        Ptr<NetDevice> gnb = gnbNetDev.Get(i);
+        UintegerValue numerology(i % 4);
+
+        // BWP0, the TDD one
+        NrHelper::GetGnbPhy(gnb, 0)->SetAttribute("Numerology", numerology);
+        NrHelper::GetGnbPhy(gnb, 0)->SetAttribute("Pattern", StringValue("F|F|F|F|F|F|F|F|F|F|"));
+        NrHelper::GetGnbPhy(gnb, 0)->SetAttribute("TxPower", DoubleValue(4.0));
+
+        // BWP1, FDD-DL
+        NrHelper::GetGnbPhy(gnb, 1)->SetAttribute("Numerology", numerology);
+        NrHelper::GetGnbPhy(gnb, 1)
+            ->SetAttribute("Pattern", StringValue("DL|DL|DL|DL|DL|DL|DL|DL|DL|DL|"));
+        NrHelper::GetGnbPhy(gnb, 1)->SetAttribute("TxPower", DoubleValue(4.0));
+
+        // BWP2, FDD-UL
+        NrHelper::GetGnbPhy(gnb, 2)->SetAttribute("Numerology", numerology);
+        NrHelper::GetGnbPhy(gnb, 2)
+            ->SetAttribute("Pattern", StringValue("UL|UL|UL|UL|UL|UL|UL|UL|UL|UL|"));
+        NrHelper::GetGnbPhy(gnb, 2)->SetAttribute("TxPower", DoubleValue(0.0));
+
+        // Link the two FDD BWP:
+        NrHelper::GetBwpManagerGnb(gnb)->SetOutputLink(2, 1);
+
+        // BWP3, the TDD one of the mMTC bearer
+        if (mmtcDevices > 0)
+        {
+            NrHelper::GetGnbPhy(gnb, bwpIdForMmtc)->SetAttribute("Numerology", numerology);
+            NrHelper::GetGnbPhy(gnb, bwpIdForMmtc)
+                ->SetAttribute("Pattern", StringValue("F|F|F|F|F|F|F|F|F|F|"));
+            NrHelper::GetGnbPhy(gnb, bwpIdForMmtc)->SetAttribute("TxPower", DoubleValue(4.0));
+        }
+    }
+
+    // The shared BWP orders the UEs and, within a UE, the bearers by QoS: voice
+    // (priority 20) before video (40). Voice is the first dedicated bearer (LCID 4)
+    if (urllcSharedBwp)
+    {
+        for (uint32_t i = 0; i < gnbNetDev.GetN(); ++i)
+        {
+            auto scheduler = DynamicCast<SharedBwpScheduler>(
+                NrHelper::GetScheduler(gnbNetDev.Get(i), bwpIdForVideo));
+            scheduler->SetAttribute("SchedLcAlgorithmType",
+                                    TypeIdValue(NrMacSchedulerLcQos::GetTypeId()));
+            scheduler->EnableSharedBwp(4, urllcMiniSlotSymbols, urllcPreemption);
+            NrHelper::GetGnbMac(gnbNetDev.Get(i), bwpIdForVideo)
+                ->TraceConnectWithoutContext(
+                    "DlScheduling",
+                    MakeCallback(&SharedBwpScheduler::NotifyDlScheduling, scheduler));
+        }
+    }
 
     // Set the UE routing:
 
@@ -396,6 +3902,7 @@ uint32_t prbMmtc = std::stoi(getConf("prbMmtc", "50"));
     uint16_t dlPortVideo = 1234;
     uint16_t dlPortVoice = 1235;
     uint16_t ulPortGaming = 1236;
+    uint16_t ulPortMmtc = 1237;
 
     ApplicationContainer serverApps;
 
@@ -409,6 +3916,11 @@ uint32_t prbMmtc = std::stoi(getConf("prbMmtc", "50"));
     serverApps.Add(dlPacketSinkVideo.Install(gridScenario.GetUserTerminals()));
     serverApps.Add(dlPacketSinkVoice.Install(gridScenario.GetUserTerminals()));
     serverApps.Add(ulPacketSinkVoice.Install(remoteHost));
+    if (mmtcDevices > 0)
+    {
+        UdpServerHelper ulPacketSinkMmtc(ulPortMmtc);
+        serverApps.Add(ulPacketSinkMmtc.Install(remoteHost));
+    }
 
     /*
      * Configure attributes for the different generators, using user-provided
@@ -464,10 +3976,23 @@ uint32_t prbMmtc = std::stoi(getConf("prbMmtc", "50"));
     ulpfGaming.direction = NrEpcTft::UPLINK;
     gamingTft->Add(ulpfGaming);
 
+    // The bearer of the mMTC reports, a non-GBR one with the QoS of the default
+    // bearer but its own BWP (QCI 8 differs from 9 only by its priority)
+    NrEpsBearer mmtcBearer(NrEpsBearer::NGBR_VIDEO_TCP_PREMIUM);
+
+    // The filter for the mMTC reports
+    Ptr<NrEpcTft> mmtcTft = Create<NrEpcTft>();
+    NrEpcTft::PacketFilter ulpfMmtc;
+    ulpfMmtc.remotePortStart = ulPortMmtc;
+    ulpfMmtc.remotePortEnd = ulPortMmtc;
+    ulpfMmtc.direction = NrEpcTft::UPLINK;
+    mmtcTft->Add(ulpfMmtc);
+
     /*
      * installing the applications
      */
     ApplicationContainer clientApps;
+    std::map<std::string, ApplicationContainer> clientAppsBySlice;
 
     for (uint32_t i = 0; i < gridScenario.GetUserTerminals().GetN(); ++i)
     {
@@ -483,6 +4008,7 @@ uint32_t prbMmtc = std::stoi(getConf("prbMmtc", "50"));
                 "Remote",
                 AddressValue(addressUtils::ConvertToSocketAddress(ueAddress, dlPortVoice)));
             clientApps.Add(dlClientVoice.Install(remoteHost));
+            clientAppsBySlice["voice"].Add(clientApps.Get(clientApps.GetN() - 1));
 
             nrHelper->ActivateDedicatedEpsBearer(ueDevice, voiceBearer, voiceTft);
         }
@@ -493,6 +4019,7 @@ uint32_t prbMmtc = std::stoi(getConf("prbMmtc", "50"));
                 "Remote",
                 AddressValue(addressUtils::ConvertToSocketAddress(ueAddress, dlPortVideo)));
             clientApps.Add(dlClientVideo.Install(remoteHost));
+            clientAppsBySlice["video"].Add(clientApps.Get(clientApps.GetN() - 1));
 
             nrHelper->ActivateDedicatedEpsBearer(ueDevice, videoBearer, videoTft);
         }
@@ -507,9 +4034,40 @@ uint32_t prbMmtc = std::stoi(getConf("prbMmtc", "50"));
                 AddressValue(
                     addressUtils::ConvertToSocketAddress(remoteHostIpv4Address, ulPortGaming)));
             clientApps.Add(ulClientGaming.Install(ue));
+            clientAppsBySlice["gaming"].Add(clientApps.Get(clientApps.GetN() - 1));
 
             nrHelper->ActivateDedicatedEpsBearer(ueDevice, gamingBearer, gamingTft);
         }
+
+        // The mMTC reports of the cell are sent by its UE (AggregatedMmtcSource)
+        if (mmtcDevices > 0)
+        {
+            nrHelper->ActivateDedicatedEpsBearer(ueDevice, mmtcBearer, mmtcTft);
+        }
+    }
+
+    // One aggregated mMTC source per cell. Its reports are sent by the UE of
+    // the cell, over the mMTC bearer
+    std::vector<std::unique_ptr<AggregatedMmtcSource>> mmtcSources;
+    if (mmtcDevices > 0)
+    {
+        AggregatedMmtcSource::Parameters mmtcParams;
+        mmtcParams.devices = mmtcDevices;
+        mmtcParams.reportInterval = MilliSeconds(mmtcReportIntervalMs);
+        mmtcParams.packetSize = mmtcPacketSize;
+        mmtcParams.rachPeriod = MilliSeconds(mmtcRachPeriodMs);
+        for (uint32_t i = 0; i < ueNetDev.GetN(); ++i)
+        {
+            uint16_t cellId = DynamicCast<NrGnbNetDevice>(gnbNetDev.Get(i))->GetCellId();
+            auto source = std::make_unique<AggregatedMmtcSource>(mmtcParams, cellId);
+            randomStream += source->AssignStreams(randomStream);
+            Simulator::Schedule(MilliSeconds(udpAppStartTimeMs),
+                                &AggregatedMmtcSource::Start,
+                                source.get(),
+                                gridScenario.GetUserTerminals().Get(i),
+                                Address(InetSocketAddress(remoteHostIpv4Address, ulPortMmtc)));
+            mmtcSources.push_back(std::move(source));
+        }
     }
 
     // start UDP server and client apps
@@ -530,9 +4088,284 @@ uint32_t prbMmtc = std::stoi(getConf("prbMmtc", "50"));
     monitor->SetAttribute("DelayBinWidth", DoubleValue(0.001));
     monitor->SetAttribute("JitterBinWidth", DoubleValue(0.001));
     monitor->SetAttribute("PacketSizeBinWidth", DoubleValue(20));
+
+    // Periodic per-flow and per-slice deltas, written while the simulation runs
+    std::map<uint16_t, std::string> sliceByPort = {{dlPortVoice, "voice"},
+                                                   {dlPortVideo, "video"},
+                                                   {ulPortGaming, "gaming"},
+                                                   {ulPortMmtc, "mmtc"}};
+    std::unique_ptr<FlowStatsReporter> flowStatsReporter;
+    std::unique_ptr<ConvergenceMonitor> convergenceMonitor;
+    if (flowStatsIntervalMs > 0 || convergenceBatchMs > 0)
+    {
+        // Without a report interval, the reporter only feeds the convergence monitor
+        uint32_t reportIntervalMs = flowStatsIntervalMs > 0 ? flowStatsIntervalMs : convergenceBatchMs;
+        flowStatsReporter = std::make_unique<FlowStatsReporter>(
+            monitor,
+            DynamicCast<Ipv4FlowClassifier>(flowmonHelper.GetClassifier()),
+            sliceByPort,
+            flowStatsIntervalMs > 0 ? outputDir + "/" + simTag + "-flow-stats.csv" : "");
+        flowStatsReporter->Start(MilliSeconds(udpAppStartTimeMs), MilliSeconds(reportIntervalMs));
+    }
+    if (convergenceBatchMs > 0)
+    {
+        convergenceMonitor = std::make_unique<ConvergenceMonitor>(MilliSeconds(convergenceBatchMs),
+                                                                  convergencePrecision,
+                                                                  convergenceMinBatches);
+        convergenceMonitor->Start(MilliSeconds(udpAppStartTimeMs));
+        flowStatsReporter->SetSliceCallback(
+            [&convergenceMonitor](const std::map<std::string, FlowStatsReporter::Counters>& d) {
+                convergenceMonitor->AddSliceDeltas(d);
+            });
+    }
+
+    // Allocated versus available resources of every slot, per cell and BWP (slice)
+    std::unique_ptr<SlotStatsTracer> slotStatsTracer;
+    if (slotStatsMode != "off")
+    {
+        slotStatsTracer = std::make_unique<SlotStatsTracer>(
+            outputDir + "/" + simTag + "-slot-stats.bin",
+            slotStatsMode == "ms");
+        slotStatsTracer->Connect(gnbNetDev, numBwps);
+    }
+
+    // Dedicated bearers get LCIDs from 4 on, in the order they are activated above
+    std::map<uint8_t, std::string> sliceByLcid;
+    uint8_t nextLcid = 4;
+    for (const auto& [slice, enabled] :
+         std::vector<std::pair<std::string, bool>>{{"voice", enableVoice},
+                                                   {"video", enableVideo},
+                                                   {"gaming", enableGaming},
+                                                   {"mmtc", mmtcDevices > 0}})
+    {
+        if (enabled)
+        {
+            sliceByLcid[nextLcid++] = slice;
+        }
+    }
+
+    // Per-slice latency components; each slice has its own BWP
+    std::unique_ptr<LatencyDecomposition> latency;
+    if (latencyDecomposition)
+    {
+        // HARQ and air time are per BWP: a shared BWP is counted as video
+        std::map<uint16_t, std::string> sliceByBwp{{bwpIdForVideo, "video"},
+                                                   {bwpIdForGaming, "gaming"}};
+        sliceByBwp.emplace(bwpIdForVoice, "voice");
+        latency = std::make_unique<LatencyDecomposition>(
+            std::vector<std::string>{"voice", "video", "gaming"},
+            sliceByLcid,
+            sliceByBwp);
+        for (const auto& [slice, apps] : clientAppsBySlice)
+        {
+            latency->ConnectClients(apps, slice);
+        }
+        latency->ConnectServers(serverApps);
+        latency->SetSymbolPeriods(gnbNetDev, numBwps);
+        Simulator::Schedule(MilliSeconds(udpAppStartTimeMs),
+                            &LatencyDecomposition::ConnectRadioTraces,
+                            latency.get());
+    }
+
+    // Periodic UL grants for the gaming bearer, each sized for the packets
+    // expected in one period (payload plus IPv4, UDP and PDCP headers)
+    std::unique_ptr<ConfiguredGrantUplink> configuredGrant;
+    if (configuredGrantGaming && enableGaming)
+    {
+        Time period = configuredGrantPeriodUs > 0 ? MicroSeconds(configuredGrantPeriodUs)
+                                                  : Seconds(1.0 / lambdaGaming);
+        uint32_t packetsPerOccasion =
+            static_cast<uint32_t>(std::ceil(lambdaGaming * period.GetSeconds()));
+        uint32_t occasionBytes = packetsPerOccasion * (udpPacketSizeGaming + 20 + 8 + 2);
+        // Dedicated bearers get LCIDs from 4 on; GBR bearers are in LCG 1
+        uint8_t gamingLcid = 4 + enableVoice + enableVideo;
+        configuredGrant = std::make_unique<ConfiguredGrantUplink>(period,
+                                                                  occasionBytes,
+                                                                  1,
+                                                                  gamingLcid,
+                                                                  bwpIdForGaming);
+        Simulator::Schedule(MilliSeconds(udpAppStartTimeMs),
+                            &ConfiguredGrantUplink::Start,
+                            configuredGrant.get(),
+                            ueNetDev);
+    }
+
+    // RBG restrictions of the fluid background and of the DRL environment actions
+    NotchedRbgMasks notchedMasks;
+
+    // Background load of the designated cells as fluid rate processes
+    std::vector<std::unique_ptr<FluidBackgroundLoad>> fluidBackground;
+    if (fluidBackgroundMbps > 0)
+    {
+        std::vector<uint32_t> cells;
+        std::stringstream cellList(fluidBackgroundCells);
+        for (std::string cell; std::getline(cellList, cell, ',');)
+        {
+            cells.push_back(std::stoi(cell));
+        }
+        for (uint32_t i = 0; i < gnbNetDev.GetN(); ++i)
+        {
+            if (!cells.empty() && std::find(cells.begin(), cells.end(), i) == cells.end())
+            {
+                continue;
+            }
+            fluidBackground.push_back(
+                std::make_unique<FluidBackgroundLoad>(gnbNetDev.Get(i),
+                                                      bwpIdForVideo,
+                                                      fluidBackgroundMbps,
+                                                      fluidBackgroundEfficiency,
+                                                      MilliSeconds(1),
+                                                      notchedMasks));
+            Simulator::Schedule(MilliSeconds(udpAppStartTimeMs),
+                                &FluidBackgroundLoad::Start,
+                                fluidBackground.back().get());
+        }
+    }
+
+    // Outer ring of interference-only gNBs, centred on the deployment. Each one
+    // has the DL BWPs of the gNB nearest to its site, and a UE at a uniform point
+    // within half the distance to the neighbouring sites, with the UL BWP of the
+    // UE of that gNB
+    std::vector<std::unique_ptr<InterferenceOnlyGnb>> interferers;
+    if (interfererGnbs > 0)
+    {
+        Vector centre;
+        NodeContainer gnbNodes = gridScenario.GetBaseStations();
+        for (uint32_t i = 0; i < gnbNodes.GetN(); ++i)
+        {
+            Vector position = gnbNodes.Get(i)->GetObject<MobilityModel>()->GetPosition();
+            centre.x += position.x / gnbNodes.GetN();
+            centre.y += position.y / gnbNodes.GetN();
+            centre.z = position.z;
+        }
+        std::vector<uint32_t> dlBwps{0, bwpIdForVideo};
+        if (mmtcDevices > 0)
+        {
+            dlBwps.push_back(bwpIdForMmtc);
+        }
+        double ueRadius = interfererRadius * std::sin(M_PI / std::max<uint32_t>(interfererGnbs, 2));
+        Ptr<UniformRandomVariable> uePlacement = CreateObject<UniformRandomVariable>();
+        uePlacement->SetStream(randomStream++);
+        for (uint32_t i = 0; i < interfererGnbs; ++i)
+        {
+            double angle = 2 * M_PI * i / interfererGnbs;
+            Vector site(centre.x + interfererRadius * std::cos(angle),
+                        centre.y + interfererRadius * std::sin(angle),
+                        centre.z);
+            Ptr<Node> node = CreateObject<Node>();
+            Ptr<MobilityModel> mobility = CreateObject<ConstantPositionMobilityModel>();
+            mobility->SetPosition(site);
+            node->AggregateObject(mobility);
+
+            uint32_t nearest = 0;
+            for (uint32_t g = 1; g < gnbNodes.GetN(); ++g)
+            {
+                if (CalculateDistance(gnbNodes.Get(g)->GetObject<MobilityModel>()->GetPosition(),
+                                      site) <
+                    CalculateDistance(
+                        gnbNodes.Get(nearest)->GetObject<MobilityModel>()->GetPosition(),
+                        site))
+                {
+                    nearest = g;
+                }
+            }
+
+            auto interferer =
+                std::make_unique<InterferenceOnlyGnb>(node, interfererLoad, MilliSeconds(1));
+            for (uint32_t bwpId : dlBwps)
+            {
+                interferer->AddBwp(gnbNetDev.Get(nearest), bwpId);
+            }
+            double ueDistance = ueRadius * std::sqrt(uePlacement->GetValue());
+            double ueAngle = 2 * M_PI * uePlacement->GetValue();
+            interferer->AddUlBwp(gnbNetDev.Get(nearest),
+                                 ueNetDev.Get(nearest),
+                                 bwpIdForGaming,
+                                 Vector(site.x + ueDistance * std::cos(ueAngle),
+                                        site.y + ueDistance * std::sin(ueAngle),
+                                        gridScenario.GetUserTerminals()
+                                            .Get(nearest)
+                                            ->GetObject<MobilityModel>()
+                                            ->GetPosition()
+                                            .z));
+            randomStream += interferer->AssignStreams(randomStream);
+            Simulator::Schedule(MilliSeconds(udpAppStartTimeMs),
+                                &InterferenceOnlyGnb::Start,
+                                interferer.get());
+            interferers.push_back(std::move(interferer));
+        }
+    }
+
+    // RLC buffers of the bearers, for the live metrics, the memory census, the DRL environment
+    // and the shared BWP monitor
+    std::unique_ptr<RlcQueueMonitor> rlcQueues;
+    if (metricsPort > 0 || memoryCensusMs > 0 || !envShm.empty() || urllcSharedBwp)
+    {
+        rlcQueues = std::make_unique<RlcQueueMonitor>(
+            std::vector<std::string>{"voice", "video", "gaming", "mmtc"},
+            sliceByLcid);
+        Simulator::Schedule(MilliSeconds(udpAppStartTimeMs),
+                            &RlcQueueMonitor::Connect,
+                            rlcQueues.get(),
+                            gnbNetDev,
+                            ueNetDev);
+    }
+
+    // Live Prometheus metrics on a loopback port
+    std::unique_ptr<MetricsExporter> metricsExporter;
+    if (metricsPort > 0)
+    {
+        metricsExporter = std::make_unique<MetricsExporter>(metricsPort,
+                                                            *rlcQueues,
+                                                            MilliSeconds(metricsIntervalMs));
+        metricsExporter->ConnectServers(serverApps, sliceByPort);
+        Simulator::ScheduleNow(&MetricsExporter::Start, metricsExporter.get());
+    }
+
+    // Memory footprint time series, from the start of the run
+    std::unique_ptr<MemoryCensus> memoryCensus;
+    if (memoryCensusMs > 0)
+    {
+        memoryCensus = std::make_unique<MemoryCensus>(outputDir + "/" + simTag + "-memory.csv",
+                                                      outputDir + "/" + simTag +
+                                                          "-memory-bearers.csv",
+                                                      monitor,
+                                                      *rlcQueues);
+        memoryCensus->Start(Seconds(0), MilliSeconds(memoryCensusMs));
+    }
+
+    // Environment of a DRL pool, stepped in lockstep with the other environments
+    std::unique_ptr<SharedMemoryEnv> drlEnv;
+    if (!envShm.empty())
+    {
+        drlEnv = std::make_unique<SharedMemoryEnv>(envShm,
+                                                   envIndex,
+                                                   MilliSeconds(envStepMs),
+                                                   notchedMasks,
+                                                   *rlcQueues);
+        drlEnv->AddSlice(0, gnbNetDev, bwpIdForVoice, true);
+        drlEnv->AddSlice(1, gnbNetDev, bwpIdForVideo, true);
+        drlEnv->AddSlice(2, gnbNetDev, bwpIdForGaming, false);
+        drlEnv->ConnectServers(serverApps, sliceByPort);
+        Simulator::Schedule(MilliSeconds(udpAppStartTimeMs),
+                            &SharedMemoryEnv::Start,
+                            drlEnv.get(),
+                            MilliSeconds(simTimeMs));
+    }
+
+    std::unique_ptr<SharedBwpMonitor> sharedBwpMonitor;
+    if (urllcSharedBwp)
+    {
+        sharedBwpMonitor = std::make_unique<SharedBwpMonitor>(*rlcQueues);
+        sharedBwpMonitor->Connect(gnbNetDev, bwpIdForVideo);
+    }
+
     nrHelper->EnableTraces();
     Simulator::Stop(MilliSeconds(simTimeMs));
     Simulator::Run();
+
+    // With steady-state detection the run may end before simTimeMs
+    double stopTimeMs = Simulator::Now().GetMilliSeconds();
     
     // Print per-flow statistics
     monitor->CheckForLostPackets();
@@ -573,7 +4406,7 @@ uint32_t prbMmtc = std::stoi(getConf("prbMmtc", "50"));
         outFile << "  Tx Packets: " << i->second.txPackets << "\n";
         outFile << "  Tx Bytes:   " << i->second.txBytes << "\n";
         outFile << "  TxOffered:  "
-                << i->second.txBytes * 8.0 / ((simTimeMs - udpAppStartTimeMs) / 1000.0) / 1000.0 /
+                << i->second.txBytes * 8.0 / ((stopTimeMs - udpAppStartTimeMs) / 1000.0) / 1000.0 /
                        1000.0
                 << " Mbps\n";
         outFile << "  Rx Bytes:   " << i->second.rxBytes << "\n";
@@ -582,7 +4415,7 @@ uint32_t prbMmtc = std::stoi(getConf("prbMmtc", "50"));
             // Measure the duration of the flow from receiver's perspective
             // double rxDuration = i->second.timeLastRxPacket.GetSeconds () -
             // i->second.timeFirstTxPacket.GetSeconds ();
-            double rxDuration = (simTimeMs - udpAppStartTimeMs) / 1000.0;
+            double rxDuration = (stopTimeMs - udpAppStartTimeMs) / 1000.0;
 
             averageFlowThroughput += i->second.rxBytes * 8.0 / rxDuration / 1000 / 1000;
             averageFlowDelay += 1000 * i->second.delaySum.GetSeconds() / i->second.rxPackets;
@@ -612,6 +4445,73 @@ uint32_t prbMmtc = std::stoi(getConf("prbMmtc", "50"));
     outFile << "\n\n  Mean flow throughput: " << meanFlowThroughput << "\n";
     outFile << "  Mean flow delay: " << meanFlowDelay << "\n";
 
+    if (convergenceMonitor)
+    {
+        outFile << "\n  Stop time: " << stopTimeMs << " ms ("
+                << (convergenceMonitor->HasConverged() ? "converged" : "ceiling reached") << ")\n";
+        convergenceMonitor->WriteSummary(outFile);
+    }
+
+    if (latency)
+    {
+        latency->WriteSummary(outputDir + "/" + simTag + "-latency.csv", outFile);
+    }
+
+    if (configuredGrant)
+    {
+        configuredGrant->WriteSummary(outFile);
+    }
+
+    if (sharedBwpMonitor)
+    {
+        sharedBwpMonitor->WriteSummary(outFile);
+    }
+
+    if (blerTable)
+    {
+        TabulatedEesmIrT1::WriteValidation(outFile);
+    }
+
+    if (memoryCensus)
+    {
+        memoryCensus->WriteSummary(outFile);
+    }
+
+    if (drlEnv)
+    {
+        drlEnv->WriteSummary(outFile);
+    }
+
+    if (!interferers.empty())
+    {
+        double occupancy = 0.0;
+        for (const auto& interferer : interferers)
+        {
+            occupancy += interferer->GetOccupancy() / interferers.size();
+        }
+        outFile << "\n  Interference-only gNBs: " << interferers.size() << " at "
+                << interfererRadius << " m, mean DL and UL RBG occupancy " << 100.0 * occupancy
+                << " %\n";
+    }
+
+    if (!fluidBackground.empty())
+    {
+        outFile << "\n  Fluid background load:\n";
+        for (const auto& background : fluidBackground)
+        {
+            background->WriteSummary(outFile);
+        }
+    }
+
+    if (!mmtcSources.empty())
+    {
+        outFile << "\n  Aggregated mMTC access:\n";
+        for (const auto& source : mmtcSources)
+        {
+            source->WriteSummary(outFile);
+        }
+    }
+
     outFile.close();
 
     std::ifstream f(filename.c_str());
@@ -635,3 +4535,85 @@ uint32_t prbMmtc = std::stoi(getConf("prbMmtc", "50"));
     }
 }
 
+/**
+ * Bring the process back to the state of a fresh launch, between two runs of
+ * a batch: attribute defaults and global values, automatic random stream
+ * numbers, allocated addresses, object names and the static counters of this
+ * file. The BLER table stays loaded.
+ */
+static void
+ResetGlobalState()
+{
+    Simulator::Destroy(); // already done by a run that completed
+    Config::Reset();
+    RngSeedManager::ResetNextStreamIndex();
+    Ipv4AddressGenerator::Reset();
+    Ipv6AddressGenerator::Reset();
+    Names::Clear();
+    TabulatedEesmIrT1::ResetValidation();
+    CountingMapScheduler::ResetPending();
+}
+
+/**
+ * Without --batchFile, a single scenario is run from the command line. With
+ * --batchFile=<file>, every non-empty line of the file not starting with '#' is
+ * the command line of one scenario, for example
+ *
+ *   --configFile=urllc.txt --RngRun=3 --outputDir=runs/urllc-3
+ *
+ * and the scenarios run one after the other in this process, with
+ * Simulator::Destroy() and ResetGlobalState() in between. Each run works in
+ * its own output directory (default run-<n>, counting the scenarios from 0),
+ * so that the NR trace files, written to the working directory, are kept
+ * apart too; the configFile and blerTableFile paths are taken relative to the
+ * directory the batch is started from (ReadBatchFile). The default simTag of
+ * a run is "results". The exit status is that of the last failed run, if any.
+ * A fatal error (NS_FATAL_ERROR, NS_ABORT_MSG_IF, a crash) ends the process and
+ * so the rest of the batch; ScenarioRunner.run_batch restarts the runs after
+ * the failed one in a new batch.
+ */
+int
+main(int argc, char* argv[])
+{
+    std::string batchFile;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg.rfind("--batchFile=", 0) == 0)
+        {
+            batchFile = arg.substr(std::string("--batchFile=").size());
+        }
+    }
+    if (batchFile.empty())
+    {
+        return RunScenario(argc, argv);
+    }
+
+    std::ifstream batch(batchFile);
+    NS_ABORT_MSG_IF(!batch.is_open(), "Can't open batch file " << batchFile);
+    const std::filesystem::path batchDir = std::filesystem::current_path();
+    int status = EXIT_SUCCESS;
+    for (BatchRun& run : ReadBatchFile(batch, argv[0], batchDir))
+    {
+        std::filesystem::create_directories(run.runDir);
+        std::filesystem::current_path(run.runDir);
+        std::cout << "Batch run " << run.index << ": " << run.line << " (in "
+                  << run.runDir.string() << ")" << std::endl;
+
+        std::vector<char*> runArgv;
+        for (std::string& arg : run.args)
+        {
+            runArgv.push_back(arg.data());
+        }
+        int runStatus = RunScenario(runArgv.size(), runArgv.data());
+        if (runStatus != EXIT_SUCCESS)
+        {
+            std::cerr << "Batch run " << run.index << " failed with " << runStatus << std::endl;
+            status = runStatus;
+        }
+
+        std::filesystem::current_path(batchDir);
+        ResetGlobalState();
+    }
+    return status;
+}
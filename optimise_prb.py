@@ -0,0 +1,181 @@
+import argparse
+import os
+import random
+import re
+from concurrent.futures import ThreadPoolExecutor
+
+import pandas as pd
+
+from result_cache import ResultCache
+from sim_runner import ScenarioRunner
+
+# CLI parameter of the PRBs of each slice in nr-multi-slice-sim.cc
+PRB_PARAMS = {'voice': 'prbVoice', 'video': 'prbVideo', 'gaming': 'prbGaming'}
+
+
+def parse_sla(text):
+    """Parse 'slice:kpi<=value' or 'slice:kpi>=value' into (slice, kpi, op, value)"""
+    match = re.fullmatch(r'(\w+):(\w+)\s*(<=|>=)\s*([-+0-9.eE]+)', text.strip())
+    if not match:
+        raise argparse.ArgumentTypeError(f"invalid SLA '{text}', expected slice:kpi<=value")
+    return match.group(1), match.group(2), match.group(3), float(match.group(4))
+
+
+def sla_violation(kpis, slas):
+    """Sum of the relative SLA violations of one run (0 when every SLA is met)"""
+    if kpis is None:
+        return float('inf')
+    violation = 0.0
+    for slice_name, kpi, op, limit in slas:
+        value = kpis.get(slice_name, {}).get(kpi)
+        if value is None:
+            return float('inf')
+        excess = value - limit if op == '<=' else limit - value
+        violation += max(0.0, excess) / max(abs(limit), 1e-9)
+    return violation
+
+
+class PrbSplitOptimiser:
+    def __init__(self, runner, slas, prb_range=(5, 100), eta=3, min_run_ms=100,
+                 app_start_ms=400, seed=1, first_run_seed=1):
+        """
+        Successive halving over PRB splits
+
+        All candidates are first evaluated with short runs; only the best
+        1/eta of them are re-evaluated with eta times longer runs, until at
+        most eta candidates are left. Candidates are ranked first by SLA
+        violation, then by total number of PRBs. Every rung runs with a new
+        seed, so that the survivors are not selected and confirmed on the
+        same random realisation.
+
+        Args:
+            runner: ScenarioRunner used to launch the simulations
+            slas: list of (slice, kpi, op, limit) targets
+            prb_range: (min, max) PRBs of each slice
+            eta: reduction factor between rungs
+            min_run_ms: traffic duration of the first rung
+            app_start_ms: application start time, added to every run length
+            seed: seed of the candidate sampling
+            first_run_seed: RngRun of the first rung, incremented at every rung
+        """
+        self.runner = runner
+        self.slas = slas
+        self.prb_range = prb_range
+        self.eta = eta
+        self.min_run_ms = min_run_ms
+        self.app_start_ms = app_start_ms
+        self.rng = random.Random(seed)
+        self.first_run_seed = first_run_seed
+        self.history = []
+
+    def sample_candidates(self, count):
+        """Latin hypercube sample of PRB splits, so every slice range is covered"""
+        low, high = self.prb_range
+        columns = []
+        for _ in PRB_PARAMS:
+            strata = list(range(count))
+            self.rng.shuffle(strata)
+            columns.append([int(low + (high - low) * (s + self.rng.random()) / count)
+                            for s in strata])
+        return [dict(zip(PRB_PARAMS, split)) for split in zip(*columns)]
+
+    def evaluate(self, pool, candidates, rung, run_ms):
+        """Run all candidates of a rung in parallel and rank them"""
+        seed = self.first_run_seed + rung
+        futures = []
+        for split in candidates:
+            overrides = {PRB_PARAMS[s]: prbs for s, prbs in split.items()}
+            overrides['simTimeMs'] = self.app_start_ms + run_ms
+            overrides['udpAppStartTimeMs'] = self.app_start_ms
+            name = f"rung{rung}-" + '-'.join(str(split[s]) for s in PRB_PARAMS)
+            futures.append((split, pool.submit(self.runner.run, overrides, name, seed)))
+
+        results = []
+        for split, future in futures:
+            kpis = future.result()
+            row = {'rung': rung, 'run_ms': run_ms, 'seed': seed, **split,
+                   'total_prb': sum(split.values()),
+                   'violation': sla_violation(kpis, self.slas)}
+            results.append(row)
+            self.history.append(row)
+        results.sort(key=lambda r: (r['violation'] > 0, r['violation'], r['total_prb']))
+        return results
+
+    def run(self, num_candidates=27, jobs=None):
+        """
+        Returns:
+            DataFrame of every evaluation
+        """
+        candidates = self.sample_candidates(num_candidates)
+        rung = 0
+        run_ms = self.min_run_ms
+        with ThreadPoolExecutor(max_workers=jobs or os.cpu_count()) as pool:
+            while True:
+                results = self.evaluate(pool, candidates, rung, run_ms)
+                feasible = sum(1 for r in results if r['violation'] == 0)
+                print(f"Rung {rung}: {len(results)} splits, {run_ms} ms, {feasible} feasible")
+                if len(results) <= self.eta:
+                    break
+                keep = max(1, len(results) // self.eta)
+                candidates = [{s: r[s] for s in PRB_PARAMS} for r in results[:keep]]
+                rung += 1
+                run_ms *= self.eta
+        return pd.DataFrame(self.history)
+
+
+def feasible_frontier(history):
+    """
+    Splits feasible in their longest evaluation that no other such split
+    dominates (fewer or equal PRBs in every slice)
+    """
+    slices = list(PRB_PARAMS)
+    longest = history.sort_values('run_ms').groupby(slices, as_index=False).last()
+    final = longest[longest['violation'] == 0]
+    frontier = []
+    for _, row in final.iterrows():
+        dominated = any((other[slices] <= row[slices]).all() and (other[slices] < row[slices]).any()
+                        for _, other in final.iterrows())
+        if not dominated:
+            frontier.append(row)
+    return pd.DataFrame(frontier).sort_values('total_prb') if frontier else final
+
+
+if __name__ == "__main__":
+    arg_parser = argparse.ArgumentParser(
+        description="Search the smallest PRB split of nr-multi-slice-sim that meets the slice SLAs")
+    arg_parser.add_argument('--sla', type=parse_sla, action='append', required=True,
+                            help="e.g. voice:delay_ms<=2 or video:throughput_mbps>=0.1")
+    arg_parser.add_argument('--ns3-dir', default='~/ns-3-dev')
+    arg_parser.add_argument('--config-file', default='config.txt')
+    arg_parser.add_argument('--work-dir', default='runs')
+    arg_parser.add_argument('--prb-min', type=int, default=5)
+    arg_parser.add_argument('--prb-max', type=int, default=100)
+    arg_parser.add_argument('--candidates', type=int, default=27)
+    arg_parser.add_argument('--eta', type=int, default=3)
+    arg_parser.add_argument('--min-run-ms', type=int, default=100)
+    arg_parser.add_argument('--app-start-ms', type=int, default=400)
+    arg_parser.add_argument('--jobs', type=int, default=None)
+    arg_parser.add_argument('--seed', type=int, default=1)
+    arg_parser.add_argument('--first-run-seed', type=int, default=1,
+                            help="RngRun of the first rung, incremented at every rung")
+    arg_parser.add_argument('--cache-dir', default=None,
+                            help="reuse results of identical runs stored in this directory")
+    arg_parser.add_argument('--cache-max-gb', type=float, default=10.0)
+    arg_parser.add_argument('--output', default='prb_search.csv')
+    args = arg_parser.parse_args()
+
+    cache = None
+    if args.cache_dir:
+        cache = ResultCache(args.cache_dir, max_bytes=int(args.cache_max_gb * 1024 ** 3))
+    runner = ScenarioRunner(args.ns3_dir, config_file=args.config_file, work_dir=args.work_dir,
+                            cache=cache)
+    optimiser = PrbSplitOptimiser(runner, args.sla, prb_range=(args.prb_min, args.prb_max),
+                                  eta=args.eta, min_run_ms=args.min_run_ms,
+                                  app_start_ms=args.app_start_ms, seed=args.seed,
+                                  first_run_seed=args.first_run_seed)
+    history = optimiser.run(num_candidates=args.candidates, jobs=args.jobs)
+    history.to_csv(args.output, index=False)
+
+    print(f"\nAll evaluations saved to: {args.output} ({len(history)} runs)")
+    print("\nSLA-feasible frontier:")
+    print(feasible_frontier(history))
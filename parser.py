@@ -1,351 +1,734 @@
+import argparse
+import io
 import pandas as pd
 import numpy as np
+import os
+import sys
+import time
+from concurrent.futures import ProcessPoolExecutor
 from pathlib import Path
-import re
+
+# Per-bin aggregations of the unified dataset: (trace, [(output column, trace column, reduction)])
+AGGREGATIONS = [
+    ('dl_data_sinr', [('dl_sinr_mean', 'SINR(dB)', 'mean'),
+                      ('dl_sinr_std', 'SINR(dB)', 'std'),
+                      ('dl_sinr_min', 'SINR(dB)', 'min'),
+                      ('dl_sinr_max', 'SINR(dB)', 'max'),
+                      ('cellid', 'CellId', 'first'),
+                      ('rnti', 'RNTI', 'first')]),
+    ('dl_pathloss', [('dl_pathloss', 'pathLoss(dB)', 'mean')]),
+    ('ul_pathloss', [('ul_pathloss', 'pathLoss(dB)', 'mean')]),
+    ('dl_mac', [('dl_tb_size_total', 'tbSize', 'sum'),
+                ('dl_tb_size_mean', 'tbSize', 'mean'),
+                ('dl_mcs_mean', 'mcs', 'mean'),
+                ('dl_mac_transmissions', 'harqId', 'count')]),
+    ('ul_mac', [('ul_tb_size_total', 'tbSize', 'sum'),
+                ('ul_tb_size_mean', 'tbSize', 'mean'),
+                ('ul_mcs_mean', 'mcs', 'mean'),
+                ('ul_mac_transmissions', 'harqId', 'count')]),
+    ('dl_pdcp_rx', [('dl_pdcp_bytes', 'packetSize', 'sum'),
+                    ('dl_pdcp_pkt_size_mean', 'packetSize', 'mean'),
+                    ('dl_pdcp_packets', 'packetSize', 'count'),
+                    ('dl_pdcp_delay_mean', 'delay(s)', 'mean')]),
+    ('ul_pdcp_rx', [('ul_pdcp_bytes', 'packetSize', 'sum'),
+                    ('ul_pdcp_pkt_size_mean', 'packetSize', 'mean'),
+                    ('ul_pdcp_packets', 'packetSize', 'count'),
+                    ('ul_pdcp_delay_mean', 'delay(s)', 'mean')]),
+    ('dl_rlc_rx', [('dl_rlc_bytes', 'packetSize', 'sum'),
+                   ('dl_rlc_pkt_size_mean', 'packetSize', 'mean'),
+                   ('dl_rlc_packets', 'packetSize', 'count'),
+                   ('dl_rlc_delay_mean', 'delay(s)', 'mean')]),
+    ('ul_rlc_rx', [('ul_rlc_bytes', 'packetSize', 'sum'),
+                   ('ul_rlc_pkt_size_mean', 'packetSize', 'mean'),
+                   ('ul_rlc_packets', 'packetSize', 'count'),
+                   ('ul_rlc_delay_mean', 'delay(s)', 'mean')]),
+    ('rx_packet', [('rx_sinr_mean', 'SINR(dB)', 'mean'),
+                   ('rx_cqi_mean', 'CQI', 'mean'),
+                   ('rx_corrupt_count', 'corrupt', 'sum'),
+                   ('rx_bler_mean', 'TBler', 'mean'),
+                   ('rx_tb_size_total', 'tbSize', 'sum')]),
+]
+
+# Trace files in parse order: (trace, file name, column names on a '%' comment line)
+TRACE_FILES = [
+    ('dl_ctrl_sinr', 'DlCtrlSinr.txt', False),
+    ('dl_data_sinr', 'DlDataSinr.txt', False),
+    ('dl_pathloss', 'DlPathlossTrace.txt', False),
+    ('dl_mac', 'NrDlMacStats.txt', True),
+    ('dl_pdcp_rx', 'NrDlPdcpRxStats.txt', False),
+    ('dl_pdcp_tx', 'NrDlPdcpTxStats.txt', False),
+    ('dl_rlc_rx', 'NrDlRxRlcStats.txt', False),
+    ('dl_rlc_tx', 'NrDlTxRlcStats.txt', False),
+    ('ul_mac', 'NrUlMacStats.txt', True),
+    ('ul_pdcp_rx', 'NrUlPdcpRxStats.txt', False),
+    ('ul_pdcp_tx', 'NrUlPdcpTxStats.txt', False),
+    ('ul_rlc_rx', 'NrUlRlcRxStats.txt', False),
+    ('ul_rlc_tx', 'NrUlRlcTxStats.txt', False),
+    ('ul_pathloss', 'UlPathlossTrace.txt', False),
+    ('rx_packet', 'RxPacketTrace.txt', False),
+]
+
+# Rows read from a trace file at a time
+CHUNK_ROWS = 500_000
+
+# Bytes read from a followed trace file at a time
+FOLLOW_BLOCK_BYTES = 64 * 1024 * 1024
+
+# PDCP traces whose packets are also aggregated per flow, and the keys of a flow
+FLOW_TRACES = {'dl_pdcp_rx': 'dl', 'ul_pdcp_rx': 'ul'}
+FLOW_KEYS = ('cellId', 'rnti', 'lcid')
+
+# Integer columns of the training dataset; other metrics are stored as float32
+ID_COLUMNS = ('cellid', 'rnti')
+COUNT_COLUMNS = tuple(out_col for _, aggregations in AGGREGATIONS
+                      for out_col, _, how in aggregations if how == 'count')
+
+
+def time_bin(times, time_resolution):
+    """
+    Bin of every timestamp: bin b covers [b, b + 1) * time_resolution and is
+    labelled with its start. A millionth of a step of tolerance keeps a
+    timestamp on a bin edge (0.417 / 0.001 = 416.99999999999994) in the bin
+    it starts.
+    """
+    return np.floor(times / time_resolution + 1e-6).astype(np.int64)
+
+
+class TimeBins:
+    def __init__(self, bins):
+        """
+        Group the rows of a trace chunk by integer time bin
+
+        The rows are sorted by bin once (stable, so the file order is kept
+        inside every bin). Every statistic is a ufunc.reduceat reduction over
+        the bin segments. The partial sums and moments of a chunk are then
+        merged into the running ones of each bin: sums with one compensated
+        (Kahan) step, variances with the parallel (Chan et al.) formula on
+        two-pass chunk moments.
+
+        Args:
+            bins: bin index of every row, relative to the accumulator arrays
+        """
+        self.order = np.argsort(bins, kind='stable')
+        sorted_bins = bins[self.order]
+        self.starts = np.flatnonzero(np.r_[True, sorted_bins[1:] != sorted_bins[:-1]]) \
+            if len(sorted_bins) else np.empty(0, dtype=np.int64)
+        self.index = sorted_bins[self.starts]
+        self.lengths = np.diff(np.r_[self.starts, len(sorted_bins)])
+        # Bin segment of every sorted row
+        self.segment = np.repeat(np.arange(len(self.starts)), self.lengths)
+
+    def sum(self, v):
+        """Sum of every bin segment"""
+        return np.add.reduceat(v, self.starts) if len(v) else np.zeros(0)
+
+    def update(self, stats, values):
+        """
+        Fold the values of one column into its per-bin running statistics
+
+        Args:
+            stats: ColumnStats of the column
+            values: column values of the chunk rows, in file order
+        """
+        idx = self.index
+        v = values.astype(np.float64)[self.order]
+        valid = ~np.isnan(v)
+        n = self.sum(valid.astype(np.int64))
+        stats.count[idx] += n
+
+        if stats.minmax:
+            stats.min[idx] = np.fmin(stats.min[idx], np.fmin.reduceat(v, self.starts))
+            stats.max[idx] = np.fmax(stats.max[idx], np.fmax.reduceat(v, self.starts))
+
+        if stats.first is not None:
+            new = np.isnan(stats.first[idx])
+            stats.first[idx[new]] = v[self.starts][new]
+
+        if stats.sum is None and stats.m2 is None:
+            return
+        x = np.where(valid, v, 0.0)
+        chunk_sum = self.sum(x)
+
+        if stats.sum is not None:
+            total = stats.sum[idx]
+            y = chunk_sum - stats.compensation[idx]
+            t = total + y
+            c = t - total - y
+            stats.compensation[idx] = np.where(np.isnan(c), 0.0, c)
+            stats.sum[idx] = t
+
+        if stats.m2 is not None:
+            with np.errstate(invalid='ignore', divide='ignore'):
+                chunk_mean = np.where(n > 0, chunk_sum / n, 0.0)
+                chunk_m2 = self.sum(np.where(valid, (x - chunk_mean[self.segment]) ** 2, 0.0))
+            merge_moments(stats, idx, n, chunk_mean, chunk_m2)
+
+
+def merge_moments(stats, idx, n, mean, m2):
+    """
+    Merge the count, mean and sum of squared deviations of new observations
+    into the running moments of the bins idx (parallel formula of Chan et al.)
+    """
+    nobs = stats.nobs[idx]
+    total = nobs + n
+    delta = mean - stats.mean[idx]
+    with np.errstate(invalid='ignore', divide='ignore'):
+        share = np.where(total > 0, n / total, 0.0)
+    stats.mean[idx] += delta * share
+    stats.m2[idx] += m2 + delta ** 2 * nobs * share
+    stats.nobs[idx] = total
+
+
+class ColumnStats:
+    def __init__(self, reductions):
+        """
+        Per-bin running statistics of one trace column, holding only what the
+        requested reductions need
+
+        Args:
+            reductions: set of reductions computed from this column
+        """
+        self.reductions = reductions
+        self.count = np.zeros(0, dtype=np.int64)
+        self.minmax = bool(reductions & {'min', 'max'})
+        self.min = np.zeros(0) if self.minmax else None
+        self.max = np.zeros(0) if self.minmax else None
+        self.first = np.zeros(0) if 'first' in reductions else None
+        self.sum = np.zeros(0) if reductions & {'sum', 'mean'} else None
+        self.compensation = np.zeros(0) if self.sum is not None else None
+        self.nobs = np.zeros(0) if 'std' in reductions else None
+        self.mean = np.zeros(0) if 'std' in reductions else None
+        self.m2 = np.zeros(0) if 'std' in reductions else None
+
+    # Initial value of every statistic in an empty bin
+    FILL = {'count': 0, 'min': np.nan, 'max': np.nan, 'first': np.nan, 'sum': 0.0,
+            'compensation': 0.0, 'nobs': 0.0, 'mean': 0.0, 'm2': 0.0}
+
+    def arrays(self):
+        """Names of the allocated statistics"""
+        return [name for name in self.FILL if getattr(self, name) is not None]
+
+    def resize(self, prepend, size):
+        """Add prepend empty bins in front, then extend to size bins"""
+        for name in self.arrays():
+            array = getattr(self, name)
+            grown = np.full(size, self.FILL[name], dtype=array.dtype)
+            grown[prepend:prepend + len(array)] = array
+            setattr(self, name, grown)
+
+    def coarsen(self, time_bins, fine, size):
+        """
+        Statistics of wider bins, combined from the statistics of these bins
+
+        Counts and sums add up, extrema combine, the first value is the one of
+        the earliest fine bin that has one, and variances are merged with the
+        parallel (Chan et al.) formula.
+
+        Args:
+            time_bins: TimeBins grouping the fine bins by wide bin
+            fine: positions of the grouped fine bins
+            size: number of wide bins
+        """
+        coarse = ColumnStats(self.reductions)
+        coarse.resize(0, size)
+        idx, starts = time_bins.index, time_bins.starts
+        rows = fine[time_bins.order]
+        coarse.count[idx] = np.add.reduceat(self.count[rows], starts)
+
+        if self.minmax:
+            coarse.min[idx] = np.fmin.reduceat(self.min[rows], starts)
+            coarse.max[idx] = np.fmax.reduceat(self.max[rows], starts)
+
+        if self.first is not None:
+            first = self.first[rows]
+            position = np.where(np.isnan(first), len(first), np.arange(len(first)))
+            chosen = np.minimum.reduceat(position, starts)
+            found = chosen < len(first)
+            coarse.first[idx[found]] = first[chosen[found]]
+
+        if self.sum is not None:
+            coarse.sum[idx] = np.add.reduceat(self.sum[rows], starts)
+
+        if self.m2 is not None:
+            nobs, mean, m2 = self.nobs[rows], self.mean[rows], self.m2[rows]
+            n = time_bins.sum(nobs)
+            with np.errstate(invalid='ignore', divide='ignore'):
+                wide_mean = np.where(n > 0, time_bins.sum(nobs * mean) / n, 0.0)
+            spread = np.where(nobs > 0, m2 + nobs * (mean - wide_mean[time_bins.segment]) ** 2, 0.0)
+            merge_moments(coarse, idx, n, wide_mean, time_bins.sum(spread))
+        return coarse
+
+    def crop(self, lo, hi):
+        """Keep bins lo..hi-1 only"""
+        for name in self.arrays():
+            setattr(self, name, getattr(self, name)[lo:hi].copy())
+
+    def finalize(self, how, present):
+        """Value of a reduction in every bin; NaN where the trace has no row"""
+        with np.errstate(invalid='ignore', divide='ignore'):
+            if how == 'count':
+                values = self.count.astype(np.float64)
+            elif how == 'sum':
+                values = self.sum
+            elif how == 'mean':
+                values = np.where(self.count > 0, self.sum / self.count, np.nan)
+            elif how == 'std':
+                values = np.where(self.nobs > 1, np.sqrt(self.m2 / (self.nobs - 1)), np.nan)
+            elif how in ('min', 'max', 'first'):
+                values = getattr(self, how)
+            else:
+                raise ValueError(f"unknown reduction '{how}'")
+        return np.where(present, values, np.nan)
+
+
+class TraceAccumulator:
+    def __init__(self, aggregations, time_resolution, flow_keys=()):
+        """
+        Per-bin state of one trace file, updated chunk by chunk
+
+        Memory depends on the number of time bins spanned by the trace, not on
+        its number of rows.
+
+        Args:
+            aggregations: [(output column, trace column, reduction)] of the trace
+            time_resolution: bin width in seconds
+            flow_keys: columns identifying a flow, to also sum the packets
+                       (packetSize, delay(s)) of every flow and bin
+        """
+        self.aggregations = aggregations
+        self.time_resolution = time_resolution
+        self.flow_keys = list(flow_keys)
+        self.flow_parts = []
+        self.flows = None
+        self.time_col = None
+        self.columns_found = []
+        self.rows = 0
+        self.base = 0                                   # absolute bin of element 0
+        self.rows_per_bin = np.zeros(0, dtype=np.int64)
+        self.columns = {}
+        for _, in_col, how in aggregations:
+            self.columns.setdefault(in_col, set()).add(how)
+        self.columns = {col: ColumnStats(reductions) for col, reductions in self.columns.items()}
+
+    @property
+    def min_bin(self):
+        return self.base + np.flatnonzero(self.rows_per_bin)[0]
+
+    @property
+    def max_bin(self):
+        return self.base + np.flatnonzero(self.rows_per_bin)[-1]
+
+    def _reserve(self, lo, hi):
+        """Make room for the absolute bins lo..hi"""
+        if len(self.rows_per_bin) == 0:
+            self.base = lo
+        prepend = max(0, self.base - lo)
+        size = prepend + len(self.rows_per_bin)
+        needed = max(size, hi - (self.base - prepend) + 1)
+        if prepend == 0 and needed <= len(self.rows_per_bin):
+            return
+        capacity = max(needed, 2 * size)
+        grown = np.zeros(capacity, dtype=np.int64)
+        grown[prepend:prepend + len(self.rows_per_bin)] = self.rows_per_bin
+        self.rows_per_bin = grown
+        for stats in self.columns.values():
+            stats.resize(prepend, capacity)
+        self.base -= prepend
+
+    def usecols(self):
+        """Trace columns read into the accumulator, time column first"""
+        usecols = [self.time_col]
+        for col in list(self.columns) + self.flow_keys:
+            if col not in usecols:
+                usecols.append(col)
+        if self.flow_keys:
+            usecols += [col for col in ('packetSize', 'delay(s)') if col not in usecols]
+        return usecols
+
+    def add_chunk(self, chunk):
+        """Fold a chunk of trace rows into the per-bin state"""
+        if chunk.empty:
+            return
+        bins = time_bin(chunk[self.time_col].values, self.time_resolution)
+        self._reserve(bins.min(), bins.max())
+        bins -= self.base
+
+        time_bins = TimeBins(bins)
+        self.rows_per_bin[time_bins.index] += time_bins.lengths
+        self.rows += len(chunk)
+        for in_col, stats in self.columns.items():
+            time_bins.update(stats, chunk[in_col].values)
+
+        if self.flow_keys:
+            packets = pd.DataFrame({'bin': bins + self.base,
+                                    **{key: chunk[key].values for key in self.flow_keys},
+                                    'bytes': chunk['packetSize'].values,
+                                    'delay': chunk['delay(s)'].values})
+            self.flow_parts.append(packets.groupby(['bin'] + self.flow_keys).agg(
+                bytes=('bytes', 'sum'), packets=('bytes', 'size'), delay_sum=('delay', 'sum')))
+
+    def compact(self):
+        """Drop the spare capacity and the empty bins at both ends"""
+        occupied = np.flatnonzero(self.rows_per_bin)
+        lo, hi = (occupied[0], occupied[-1] + 1) if len(occupied) else (0, 0)
+        self.rows_per_bin = self.rows_per_bin[lo:hi].copy()
+        for stats in self.columns.values():
+            stats.crop(lo, hi)
+        self.base += lo
+
+        # A flow and bin cut by a chunk boundary appears in two parts
+        if self.flow_parts:
+            flows = pd.concat(self.flow_parts)
+            self.flows = flows.groupby(level=list(range(flows.index.nlevels))).sum()
+            self.flow_parts = []
+        return self
+
+    def coarsen(self, factor, time_resolution):
+        """
+        Accumulator of the same trace with bins factor times wider, derived
+        from the bins of this one without reading the trace again
+
+        Wide bin c groups the fine bins c * factor to c * factor + factor - 1,
+        which cover exactly [c, c + 1) * time_resolution, as a trace parsed at
+        the wide resolution would.
+
+        Args:
+            factor: number of fine bins per wide bin
+            time_resolution: width of the wide bins in seconds
+        """
+        coarse = TraceAccumulator(self.aggregations, time_resolution)
+        coarse.time_col = self.time_col
+        coarse.columns_found = self.columns_found
+        coarse.rows = self.rows
+
+        fine = np.flatnonzero(self.rows_per_bin)
+        if len(fine) == 0:
+            return coarse
+        wide = (fine + self.base) // factor
+        coarse.base = wide.min()
+        size = wide.max() - coarse.base + 1
+
+        time_bins = TimeBins(wide - coarse.base)
+        coarse.rows_per_bin = np.zeros(size, dtype=np.int64)
+        coarse.rows_per_bin[time_bins.index] = np.add.reduceat(
+            self.rows_per_bin[fine[time_bins.order]], time_bins.starts)
+        coarse.columns = {col: stats.coarsen(time_bins, fine, size)
+                          for col, stats in self.columns.items()}
+        return coarse
+
+    def discard_before(self, first_bin):
+        """Forget the bins before the absolute bin first_bin"""
+        cut = min(max(0, first_bin - self.base), len(self.rows_per_bin))
+        for stats in self.columns.values():
+            stats.crop(cut, len(self.rows_per_bin))
+        self.rows_per_bin = self.rows_per_bin[cut:].copy()
+        self.base += cut
+
+    def to_grid(self, columns, min_bin, n_bins):
+        """Write the aggregated columns into the grid starting at bin min_bin"""
+        grid_pos = np.arange(len(self.rows_per_bin)) + self.base - min_bin
+        inside = (grid_pos >= 0) & (grid_pos < n_bins)
+        present = self.rows_per_bin > 0
+        for out_col, in_col, how in self.aggregations:
+            column = np.full(n_bins, np.nan)
+            column[grid_pos[inside]] = self.columns[in_col].finalize(how, present)[inside]
+            columns[out_col] = column
+
+
+def trace_read_options(filepath, has_comment_header):
+    """pandas.read_csv options of a trace file"""
+    if has_comment_header:
+        # Column names are on the first line starting with '%'
+        with open(filepath, 'r') as f:
+            for i, line in enumerate(f):
+                if line.startswith('%'):
+                    header_line = line[1:].strip()
+                    if '\t' in header_line:
+                        return {'sep': '\t', 'names': header_line.split('\t'),
+                                'header': None, 'skiprows': i + 1}
+                    return {'sep': r'\s+', 'names': header_line.split(),
+                            'header': None, 'skiprows': i + 1}
+        return {'sep': r'\s+'}
+    return {'sep': r'\s+', 'comment': '%'}
+
+
+def find_time_column(columns):
+    """Identify time column among the columns of a trace"""
+    possible_names = ['Time', 'time', 'time(s)', 'Time(sec)']
+    for col in columns:
+        if col in possible_names or 'time' in col.lower():
+            return col
+    return None
+
+
+def read_trace(filepath, aggregations, has_comment_header, time_resolution, chunk_rows,
+               flow_keys=()):
+    """
+    Stream a trace file into a compacted TraceAccumulator
+
+    Only the time column and the aggregated columns are read, chunk_rows rows
+    at a time, so memory does not grow with the file size. This is a plain
+    function so that it can run in a worker process; the accumulator it
+    returns is small and cheap to send back.
+
+    Args:
+        filepath: trace file
+        aggregations: [(output column, trace column, reduction)] of the trace
+        has_comment_header: column names are given on a '%' comment line
+        time_resolution: bin width in seconds
+        chunk_rows: rows read at a time
+        flow_keys: columns identifying a flow, for the per-flow packet sums
+    """
+    options = trace_read_options(filepath, has_comment_header)
+    accumulator = TraceAccumulator(aggregations, time_resolution, flow_keys)
+    header = pd.read_csv(filepath, nrows=0, **options)
+    accumulator.columns_found = list(header.columns)
+    accumulator.time_col = find_time_column(header.columns)
+
+    if accumulator.time_col is not None:
+        for chunk in pd.read_csv(filepath, usecols=accumulator.usecols(), chunksize=chunk_rows,
+                                 **options):
+            accumulator.add_chunk(chunk)
+    else:
+        accumulator.rows = sum(len(chunk) for chunk in
+                               pd.read_csv(filepath, chunksize=chunk_rows, **options))
+    return accumulator.compact()
+
+
+# Record of the -slot-stats.bin trace of nr-multi-slice-sim.cc (SlotStatsTracer::SlotRecord)
+SLOT_RECORD = np.dtype([('time_ns', '<i8'), ('cell_id', '<u2'), ('bwp_id', '<u2'),
+                        ('slots', '<u2'), ('active_ue', '<u2'), ('used_reg', '<u4'),
+                        ('available_reg', '<u4'), ('used_sym', '<u4'), ('available_sym', '<u4')])
+
+# Slice carried by each BWP in nr-multi-slice-sim.cc
+SLICE_BY_BWP = {0: 'voice', 1: 'video', 2: 'gaming', 3: 'mmtc'}
+
+
+def read_slot_stats(path):
+    """
+    Read the per-slot (or per-ms) PRB utilisation trace written with
+    --slotStatsMode into a DataFrame, adding the slice and the utilisation
+    (allocated / available RB x symbols)
+    """
+    with open(path, 'rb') as f:
+        magic, record_size, mode = np.frombuffer(f.read(16), dtype=[('magic', 'S8'), ('size', '<u4'),
+                                                                    ('mode', '<u4')])[0]
+        if magic != b'NRSLOT1' or record_size != SLOT_RECORD.itemsize:
+            raise ValueError(f"{path}: not a slot statistics file")
+        records = np.fromfile(f, dtype=SLOT_RECORD)
+
+    df = pd.DataFrame(records)
+    df.insert(0, 'time', df.pop('time_ns') / 1e9)
+    df['slice'] = df['bwp_id'].map(SLICE_BY_BWP).fillna('other')
+    df['utilisation'] = (df['used_reg'] / df['available_reg'].where(df['available_reg'] > 0)).fillna(0)
+    df.attrs['per_ms'] = bool(mode)
+    return df
+
 
 class NS3TraceParser:
-    def __init__(self, trace_dir):
-        """Initialize parser with directory containing trace files"""
+    def __init__(self, trace_dir, chunk_rows=CHUNK_ROWS, jobs=None):
+        """
+        Initialize parser with directory containing trace files
+
+        Args:
+            trace_dir: directory of the NR trace files
+            chunk_rows: rows read from a trace file at a time
+            jobs: trace files parsed at once by worker processes
+                  (default: cores, 1 parses in this process)
+        """
         self.trace_dir = Path(trace_dir).expanduser()
+        self.chunk_rows = chunk_rows
+        self.jobs = jobs or os.cpu_count() or 1
+        self.time_resolution = None
         self.data = {}
-    
-    def parse_file(self, filename, skiprows=0, has_comment_header=False):
-        """Parse trace file and return dataframe"""
-        filepath = self.trace_dir / filename
-        
+
+    def parse_file(self, filename, aggregations=(), has_comment_header=False, flow_keys=()):
+        """
+        Stream a trace file into a TraceAccumulator
+
+        Returns:
+            TraceAccumulator, or None if the file could not be read
+        """
         try:
-            if has_comment_header:
-                with open(filepath, 'r') as f:
-                    lines = f.readlines()
-                
-                header_line = None
-                data_start = 0
-                
-                for i, line in enumerate(lines):
-                    if line.startswith('%'):
-                        header_line = line[1:].strip()
-                        data_start = i + 1
-                        break
-                
-                if header_line:
-                    delimiter = '\t' if '\t' in header_line else r'\s+'
-                    from io import StringIO
-                    data_content = ''.join(lines[data_start:])
-                    df = pd.read_csv(StringIO(header_line + '\n' + data_content), 
-                                   sep=delimiter, engine='python')
-                else:
-                    df = pd.read_csv(filepath, sep=r'\s+', skiprows=skiprows)
-            else:
-                df = pd.read_csv(filepath, sep=r'\s+', skiprows=skiprows, comment='%')
-            
-            print(f"Loaded {filename}: {len(df)} rows")
-            return df
-            
+            accumulator = read_trace(self.trace_dir / filename, aggregations, has_comment_header,
+                                     self.time_resolution, self.chunk_rows, flow_keys)
+            print(f"Loaded {filename}: {accumulator.rows} rows")
+            return accumulator
+
         except Exception as e:
             print(f"Error: {filename}: {e}")
             return None
-    
-    def parse_all_traces(self):
-        """Parse all trace files"""
+
+    def parse_all_traces(self, time_resolution=0.001):
+        """
+        Parse all trace files
+
+        Args:
+            time_resolution: Time step in seconds of the per-bin statistics (default 1ms)
+        """
         print("Parsing trace files...")
-        
-        # DL Control SINR
-        self.data['dl_ctrl_sinr'] = self.parse_file('DlCtrlSinr.txt')
-        
-        # DL Data SINR
-        self.data['dl_data_sinr'] = self.parse_file('DlDataSinr.txt')
-        
-        # DL Pathloss
-        self.data['dl_pathloss'] = self.parse_file('DlPathlossTrace.txt')
-        
-        # DL MAC Stats
-        self.data['dl_mac'] = self.parse_file('NrDlMacStats.txt', has_comment_header=True)
-        
-        # DL PDCP Stats
-        self.data['dl_pdcp_rx'] = self.parse_file('NrDlPdcpRxStats.txt')
-        self.data['dl_pdcp_tx'] = self.parse_file('NrDlPdcpTxStats.txt')
-        
-        # DL RLC Stats
-        self.data['dl_rlc_rx'] = self.parse_file('NrDlRxRlcStats.txt')
-        self.data['dl_rlc_tx'] = self.parse_file('NrDlTxRlcStats.txt')
-        
-        # UL MAC Stats
-        self.data['ul_mac'] = self.parse_file('NrUlMacStats.txt', has_comment_header=True)
-        
-        # UL PDCP Stats
-        self.data['ul_pdcp_rx'] = self.parse_file('NrUlPdcpRxStats.txt')
-        self.data['ul_pdcp_tx'] = self.parse_file('NrUlPdcpTxStats.txt')
-        
-        # UL RLC Stats
-        self.data['ul_rlc_rx'] = self.parse_file('NrUlRlcRxStats.txt')
-        self.data['ul_rlc_tx'] = self.parse_file('NrUlRlcTxStats.txt')
-        
-        # UL Pathloss
-        self.data['ul_pathloss'] = self.parse_file('UlPathlossTrace.txt')
-        
-        # RX Packet Trace
-        self.data['rx_packet'] = self.parse_file('RxPacketTrace.txt')
-        
+        self.time_resolution = time_resolution
+        self.data = {}
+
+        aggregations = dict(AGGREGATIONS)
+        if self.jobs <= 1:
+            for name, filename, has_comment_header in TRACE_FILES:
+                self.data[name] = self.parse_file(filename, aggregations.get(name, []),
+                                                  has_comment_header=has_comment_header,
+                                                  flow_keys=FLOW_KEYS if name in FLOW_TRACES else ())
+        else:
+            self._parse_concurrently(aggregations)
+
         print(f"Parsed {len([k for k, v in self.data.items() if v is not None])} files")
-    
+
+    def _parse_concurrently(self, aggregations):
+        """
+        Parse the trace files in worker processes
+
+        The largest files are submitted first, so the wall time is close to
+        the time needed for the largest file. Results are reported in the
+        usual file order.
+        """
+        def size(filename):
+            path = self.trace_dir / filename
+            return path.stat().st_size if path.exists() else 0
+
+        by_size = sorted(TRACE_FILES, key=lambda entry: size(entry[1]), reverse=True)
+        with ProcessPoolExecutor(max_workers=min(self.jobs, len(TRACE_FILES))) as pool:
+            futures = {name: pool.submit(read_trace, self.trace_dir / filename,
+                                         aggregations.get(name, []), has_comment_header,
+                                         self.time_resolution, self.chunk_rows,
+                                         FLOW_KEYS if name in FLOW_TRACES else ())
+                       for name, filename, has_comment_header in by_size}
+
+            for name, filename, _ in TRACE_FILES:
+                try:
+                    self.data[name] = futures[name].result()
+                    print(f"Loaded {filename}: {self.data[name].rows} rows")
+                except Exception as e:
+                    print(f"Error: {filename}: {e}")
+                    self.data[name] = None
+
     def create_unified_dataset(self, time_resolution=0.001):
         """
         Create unified time-series dataset with forward-fill for non-instantaneous values
-        
+
         Args:
             time_resolution: Time step in seconds (default 1ms)
         """
+        if time_resolution != self.time_resolution:
+            self.parse_all_traces(time_resolution)
+
+        return self._unified_dataset(self.data, time_resolution)
+
+    def create_dataset_pyramid(self, resolutions=(0.001, 0.01, 0.1)):
+        """
+        Create the unified dataset at several resolutions from a single parse
+
+        The traces are parsed once at the finest resolution. Every coarser
+        level is derived from the fine per-bin statistics, so the coarse
+        resolutions must be integer multiples of the finest one. A coarse step
+        groups whole fine steps: a row within half a fine step of a coarse step
+        boundary can fall in the neighbouring step compared to parsing at the
+        coarse resolution directly.
+
+        Args:
+            resolutions: Time steps in seconds
+
+        Returns:
+            dict time step -> dataset
+        """
+        resolutions = sorted(resolutions)
+        finest = resolutions[0]
+        factors = {}
+        for resolution in resolutions:
+            factor = int(round(resolution / finest))
+            if factor < 1 or abs(factor * finest - resolution) > 1e-9 * resolution:
+                raise ValueError(f"time step {resolution} is not a multiple of {finest}")
+            factors[resolution] = factor
+
+        if finest != self.time_resolution:
+            self.parse_all_traces(finest)
+
+        levels = {}
+        for resolution, factor in factors.items():
+            print(f"\n--- {resolution * 1000:g} ms level ---")
+            if factor == 1:
+                accumulators = self.data
+            else:
+                accumulators = {name: None if accumulator is None
+                                else accumulator.coarsen(factor, resolution)
+                                for name, accumulator in self.data.items()}
+            levels[resolution] = self._unified_dataset(accumulators, resolution)
+        return levels
+
+    def _unified_dataset(self, accumulators, time_resolution):
+        """Unified dataset of the per-bin statistics of every trace"""
         print("\nCreating unified dataset...")
-        
-        # Collect all unique timestamps and round them to the grid
-        all_times = set()
-        
-        for name, df in self.data.items():
-            if df is not None and not df.empty:
-                time_col = self._get_time_column(df)
-                if time_col:
-                    print(f"  {name}: time column = '{time_col}'")
-                    rounded_times = (np.round(df[time_col].values / time_resolution) * time_resolution)
-                    all_times.update(rounded_times)
+
+        # Bin range of every trace with timed rows
+        extents = []
+
+        for name, accumulator in accumulators.items():
+            if accumulator is not None and accumulator.rows > 0:
+                if accumulator.time_col:
+                    print(f"  {name}: time column = '{accumulator.time_col}'")
+                    extents.append((accumulator.min_bin, accumulator.max_bin))
                 else:
-                    print(f"  {name}: NO TIME COLUMN FOUND (columns: {list(df.columns)})")
-        
-        # Create time index from rounded values
-        if not all_times:
+                    print(f"  {name}: NO TIME COLUMN FOUND (columns: {accumulator.columns_found})")
+
+        # Create time index from the bin starts
+        if not extents:
             print("No time data found!")
             return None
-        
-        min_time = min(all_times)
-        max_time = max(all_times)
-        
+
+        min_bin = min(lo for lo, _ in extents)
+        max_bin = max(hi for _, hi in extents)
+        min_time = min_bin * time_resolution
+        max_time = max_bin * time_resolution
+
         # Create regular time grid
         time_index = np.arange(min_time, max_time + time_resolution, time_resolution)
-        
+
         print(f"Time range: {min_time:.6f}s to {max_time:.6f}s")
         print(f"Time steps: {len(time_index)}")
-        
-        # Initialize result dataframe
-        result = pd.DataFrame({'time': time_index})
-        
-        # Process each trace file (now with rounded timestamps)
-        result = self._merge_dl_sinr(result, time_resolution)
-        result = self._merge_pathloss(result, time_resolution)
-        result = self._merge_mac_stats(result, time_resolution)
-        result = self._merge_pdcp_stats(result, time_resolution)
-        result = self._merge_rlc_stats(result, time_resolution)
-        result = self._merge_rx_packet(result, time_resolution)
-        
+
+        # Write the per-bin statistics of each trace into columns of the grid
+        columns = {'time': time_index}
+        for name, _ in AGGREGATIONS:
+            accumulator = accumulators.get(name)
+            if accumulator is None:
+                continue
+            accumulator.to_grid(columns, min_bin, len(time_index))
+
+        result = pd.DataFrame(columns)
+
         # Forward fill for non-instantaneous values
         print("\nForward-filling non-instantaneous values...")
         result = result.ffill()
-        
+
         # Fill remaining NaN with 0 (for beginning of trace)
         result = result.fillna(0)
-        
-        return result
-    
-    def _get_time_column(self, df):
-        """Identify time column in dataframe"""
-        possible_names = ['Time', 'time', 'time(s)', 'Time(sec)']
-        for col in df.columns:
-            if col in possible_names or 'time' in col.lower():
-                return col
-        return None
-    
-    def _merge_dl_sinr(self, result, time_resolution):
-        """Merge DL SINR data"""
-        if self.data['dl_data_sinr'] is not None:
-            df = self.data['dl_data_sinr'].copy()
-            df['time'] = np.round(df['Time'].values / time_resolution) * time_resolution
-            
-            agg_df = df.groupby('time').agg({
-                'SINR(dB)': ['mean', 'std', 'min', 'max'],
-                'CellId': 'first',
-                'RNTI': 'first'
-            }).reset_index()
-            
-            agg_df.columns = ['time', 'dl_sinr_mean', 'dl_sinr_std', 
-                            'dl_sinr_min', 'dl_sinr_max', 'cellid', 'rnti']
-            
-            result = result.merge(agg_df, on='time', how='left')
-        
-        return result
-    
-    def _merge_pathloss(self, result, time_resolution):
-        """Merge pathloss data"""
-        # DL Pathloss
-        if self.data['dl_pathloss'] is not None:
-            df = self.data['dl_pathloss'].copy()
-            df['time'] = np.round(df['Time(sec)'].values / time_resolution) * time_resolution
-            
-            agg_df = df.groupby('time').agg({
-                'pathLoss(dB)': 'mean',
-                'CellId': 'first'
-            }).reset_index()
-            
-            agg_df = agg_df.rename(columns={'pathLoss(dB)': 'dl_pathloss'})
-            result = result.merge(agg_df[['time', 'dl_pathloss']], on='time', how='left')
-        
-        # UL Pathloss
-        if self.data['ul_pathloss'] is not None:
-            df = self.data['ul_pathloss'].copy()
-            df['time'] = np.round(df['Time(sec)'].values / time_resolution) * time_resolution
-            
-            agg_df = df.groupby('time').agg({
-                'pathLoss(dB)': 'mean'
-            }).reset_index()
-            
-            agg_df = agg_df.rename(columns={'pathLoss(dB)': 'ul_pathloss'})
-            result = result.merge(agg_df, on='time', how='left')
-        
-        return result
-    
-    def _merge_mac_stats(self, result, time_resolution):
-        """Merge MAC layer statistics"""
-        # DL MAC
-        if self.data['dl_mac'] is not None:
-            df = self.data['dl_mac'].copy()
-            df['time'] = np.round(df['time(s)'].values / time_resolution) * time_resolution
-            
-            agg_df = df.groupby('time').agg({
-                'tbSize': ['sum', 'mean'],
-                'mcs': 'mean',
-                'harqId': 'count'
-            }).reset_index()
-            
-            agg_df.columns = ['time', 'dl_tb_size_total', 'dl_tb_size_mean', 
-                            'dl_mcs_mean', 'dl_mac_transmissions']
-            
-            result = result.merge(agg_df, on='time', how='left')
-        
-        # UL MAC
-        if self.data['ul_mac'] is not None:
-            df = self.data['ul_mac'].copy()
-            df['time'] = np.round(df['time(s)'].values / time_resolution) * time_resolution
-            
-            agg_df = df.groupby('time').agg({
-                'tbSize': ['sum', 'mean'],
-                'mcs': 'mean',
-                'harqId': 'count'
-            }).reset_index()
-            
-            agg_df.columns = ['time', 'ul_tb_size_total', 'ul_tb_size_mean', 
-                            'ul_mcs_mean', 'ul_mac_transmissions']
-            
-            result = result.merge(agg_df, on='time', how='left')
-        
-        return result
-    
-    def _merge_pdcp_stats(self, result, time_resolution):
-        """Merge PDCP layer statistics"""
-        # DL PDCP
-        if self.data['dl_pdcp_rx'] is not None:
-            df = self.data['dl_pdcp_rx'].copy()
-            df['time'] = np.round(df['time(s)'].values / time_resolution) * time_resolution
-            
-            agg_df = df.groupby('time').agg({
-                'packetSize': ['sum', 'mean', 'count'],
-                'delay(s)': 'mean'
-            }).reset_index()
-            
-            agg_df.columns = ['time', 'dl_pdcp_bytes', 'dl_pdcp_pkt_size_mean', 
-                            'dl_pdcp_packets', 'dl_pdcp_delay_mean']
-            
-            result = result.merge(agg_df, on='time', how='left')
-        
-        # UL PDCP
-        if self.data['ul_pdcp_rx'] is not None:
-            df = self.data['ul_pdcp_rx'].copy()
-            df['time'] = np.round(df['time(s)'].values / time_resolution) * time_resolution
-            
-            agg_df = df.groupby('time').agg({
-                'packetSize': ['sum', 'mean', 'count'],
-                'delay(s)': 'mean'
-            }).reset_index()
-            
-            agg_df.columns = ['time', 'ul_pdcp_bytes', 'ul_pdcp_pkt_size_mean', 
-                            'ul_pdcp_packets', 'ul_pdcp_delay_mean']
-            
-            result = result.merge(agg_df, on='time', how='left')
-        
-        return result
-    
-    def _merge_rlc_stats(self, result, time_resolution):
-        """Merge RLC layer statistics"""
-        # DL RLC
-        if self.data['dl_rlc_rx'] is not None:
-            df = self.data['dl_rlc_rx'].copy()
-            df['time'] = np.round(df['time(s)'].values / time_resolution) * time_resolution
-            
-            agg_df = df.groupby('time').agg({
-                'packetSize': ['sum', 'mean', 'count'],
-                'delay(s)': 'mean'
-            }).reset_index()
-            
-            agg_df.columns = ['time', 'dl_rlc_bytes', 'dl_rlc_pkt_size_mean', 
-                            'dl_rlc_packets', 'dl_rlc_delay_mean']
-            
-            result = result.merge(agg_df, on='time', how='left')
-        
-        # UL RLC
-        if self.data['ul_rlc_rx'] is not None:
-            df = self.data['ul_rlc_rx'].copy()
-            df['time'] = np.round(df['time(s)'].values / time_resolution) * time_resolution
-            
-            agg_df = df.groupby('time').agg({
-                'packetSize': ['sum', 'mean', 'count'],
-                'delay(s)': 'mean'
-            }).reset_index()
-            
-            agg_df.columns = ['time', 'ul_rlc_bytes', 'ul_rlc_pkt_size_mean', 
-                            'ul_rlc_packets', 'ul_rlc_delay_mean']
-            
-            result = result.merge(agg_df, on='time', how='left')
-        
-        return result
-    
-    def _merge_rx_packet(self, result, time_resolution):
-        """Merge RX packet trace"""
-        if self.data['rx_packet'] is not None:
-            df = self.data['rx_packet'].copy()
-            df['time'] = np.round(df['Time'].values / time_resolution) * time_resolution
-            
-            agg_df = df.groupby('time').agg({
-                'SINR(dB)': 'mean',
-                'CQI': 'mean',
-                'corrupt': 'sum',
-                'TBler': 'mean',
-                'tbSize': 'sum'
-            }).reset_index()
-            
-            agg_df = agg_df.rename(columns={
-                'SINR(dB)': 'rx_sinr_mean',
-                'CQI': 'rx_cqi_mean',
-                'corrupt': 'rx_corrupt_count',
-                'TBler': 'rx_bler_mean',
-                'tbSize': 'rx_tb_size_total'
-            })
-            
-            result = result.merge(agg_df, on='time', how='left')
-        
+
         return result
-    
-    def calculate_instantaneous_metrics(self, df):
+
+    def calculate_instantaneous_metrics(self, df, time_resolution=0.001):
         """
         Calculate instantaneous throughput, delay, and jitter at each timestep (1ms)
         
         Args:
             df: Dataset dataframe
+            time_resolution: Time step of the dataset in seconds (default 1ms)
         """
         print("\nCalculating instantaneous metrics...")
         
         # DL instantaneous throughput (Mbps at each 1ms timestep)
         if 'dl_pdcp_bytes' in df.columns:
-            df['dl_throughput_mbps'] = (df['dl_pdcp_bytes'] * 8) / (0.001 * 1e6)  # Convert bytes to Mbps
+            df['dl_throughput_mbps'] = (df['dl_pdcp_bytes'] * 8) / (time_resolution * 1e6)  # Convert bytes to Mbps
         
         # UL instantaneous throughput
         if 'ul_pdcp_bytes' in df.columns:
-            df['ul_throughput_mbps'] = (df['ul_pdcp_bytes'] * 8) / (0.001 * 1e6)
+            df['ul_throughput_mbps'] = (df['ul_pdcp_bytes'] * 8) / (time_resolution * 1e6)
         
         # DL delay (already calculated as mean delay per timestep in PDCP stats)
         if 'dl_pdcp_delay_mean' in df.columns:
@@ -367,6 +750,89 @@ class NS3TraceParser:
         
         return df
     
+    def flow_metrics(self):
+        """
+        Per-flow metrics as a long table, one row per flow and time step with
+        received PDCP packets
+
+        Flows are identified by (direction, cell_id, rnti, lcid). Jitter is the
+        absolute delay difference with the previous time step of the same flow.
+        """
+        tables = []
+        for name, direction in FLOW_TRACES.items():
+            accumulator = self.data.get(name)
+            if accumulator is None or accumulator.flows is None:
+                continue
+            flows = accumulator.flows.reset_index().rename(columns={'cellId': 'cell_id'})
+            flows = flows.sort_values(['cell_id', 'rnti', 'lcid', 'bin'], kind='stable')
+
+            table = pd.DataFrame({
+                'time': flows['bin'].values * self.time_resolution,
+                'direction': direction,
+                'cell_id': flows['cell_id'].values.astype(np.int32),
+                'rnti': flows['rnti'].values.astype(np.int32),
+                'lcid': flows['lcid'].values.astype(np.int16),
+                'throughput_mbps': (flows['bytes'].values * 8 / (self.time_resolution * 1e6)).astype(np.float32),
+                'delay_ms': (flows['delay_sum'].values / flows['packets'].values * 1000).astype(np.float32),
+                'packets': flows['packets'].values.astype(np.int32),
+            })
+            table['jitter_ms'] = table.groupby(['cell_id', 'rnti', 'lcid'])['delay_ms'].diff().abs().fillna(0)
+            tables.append(table)
+
+        if not tables:
+            return None
+        return pd.concat(tables, ignore_index=True)
+
+    def save_parquet(self, df, output_dir='ns3_drl_training_data.parquet', run=None, flows=True):
+        """
+        Save dataset and per-flow metrics as Parquet datasets
+
+        <output_dir>/dataset holds the time-series partitioned by run, with
+        integer ids and float32 metrics. <output_dir>/flows holds the long
+        per-flow table partitioned by run and cell. Existing partitions of the
+        same run are replaced.
+
+        Args:
+            df: Dataset dataframe
+            output_dir: root directory of the Parquet datasets
+            run: run name (default: name of the trace directory)
+            flows: also write the per-flow table
+        """
+        import pyarrow as pa
+        import pyarrow.parquet as pq
+
+        output_dir = Path(output_dir)
+        run = run or self.trace_dir.resolve().name
+
+        dtypes = {}
+        for col in df.columns:
+            if col == 'time':
+                dtypes[col] = np.float64
+            elif col in ID_COLUMNS or col in COUNT_COLUMNS:
+                dtypes[col] = np.int32
+            else:
+                dtypes[col] = np.float32
+        dataset = df.astype(dtypes)
+        dataset['run'] = run
+        pq.write_to_dataset(pa.Table.from_pandas(dataset, preserve_index=False),
+                            output_dir / 'dataset', partition_cols=['run'],
+                            existing_data_behavior='delete_matching')
+
+        flows = self.flow_metrics() if flows else None
+        if flows is not None:
+            flows['run'] = run
+            pq.write_to_dataset(pa.Table.from_pandas(flows, preserve_index=False),
+                                output_dir / 'flows', partition_cols=['run', 'cell_id'],
+                                existing_data_behavior='delete_matching')
+
+        print(f"\n{'='*70}")
+        print(f"Dataset saved to: {output_dir / 'dataset'} (run={run})")
+        print(f"{'='*70}")
+        print(f"Shape: {df.shape[0]} rows × {df.shape[1]} columns")
+        if flows is not None:
+            print(f"Per-flow metrics: {output_dir / 'flows'} ({len(flows)} rows, "
+                  f"{len(flows.groupby(['direction', 'cell_id', 'rnti', 'lcid']))} flows)")
+
     def save_dataset(self, df, output_path='ns3_training_data.csv'):
         """Save dataset to CSV"""
         df.to_csv(output_path, index=False)
@@ -392,20 +858,273 @@ class NS3TraceParser:
         print(df.describe())
 
 
+class FollowedTrace:
+    def __init__(self, filepath, accumulator, has_comment_header):
+        """
+        Trace file that is still being written, read from the last offset on
+
+        Args:
+            filepath: trace file
+            accumulator: TraceAccumulator receiving the new rows
+            has_comment_header: column names are given on a '%' comment line
+        """
+        self.filepath = filepath
+        self.accumulator = accumulator
+        self.has_comment_header = has_comment_header
+        self.options = None
+        self.offset = 0
+        self.latest_bin = None      # last bin with rows, kept when older bins are discarded
+        self.last_growth = time.monotonic()
+
+    def _read_header(self):
+        """Find the column names and the start of the data, once the header line is complete"""
+        header_line = None
+        with open(self.filepath, 'rb') as f:
+            for line in f:
+                if not line.endswith(b'\n'):
+                    return False
+                self.offset += len(line)
+                text = line.decode()
+                if self.has_comment_header and text.startswith('%'):
+                    header_line = text[1:].strip()
+                    break
+                if not self.has_comment_header and text.strip() and not text.startswith('%'):
+                    header_line = text.strip()
+                    break
+        if header_line is None:
+            self.offset = 0
+            return False
+
+        if self.has_comment_header and '\t' in header_line:
+            self.options = {'sep': '\t', 'names': header_line.split('\t'), 'header': None}
+        else:
+            self.options = {'sep': r'\s+', 'names': header_line.split(), 'header': None}
+        if not self.has_comment_header:
+            self.options['comment'] = '%'
+        self.accumulator.columns_found = self.options['names']
+        self.accumulator.time_col = find_time_column(self.options['names'])
+        return True
+
+    def read_new(self, block_bytes=FOLLOW_BLOCK_BYTES):
+        """
+        Fold the complete lines appended since the last call into the accumulator
+
+        Returns:
+            number of rows read
+        """
+        if not self.filepath.exists():
+            return 0
+        if self.options is None and not self._read_header():
+            return 0
+
+        accumulator = self.accumulator
+        rows = 0
+        with open(self.filepath, 'rb') as f:
+            while True:
+                f.seek(self.offset)
+                data = f.read(block_bytes)
+                end = data.rfind(b'\n') + 1
+                if end == 0:
+                    break
+                self.offset += end
+                if accumulator.time_col is None:
+                    count = data[:end].count(b'\n')
+                    accumulator.rows += count
+                else:
+                    chunk = pd.read_csv(io.BytesIO(data[:end]), usecols=accumulator.usecols(),
+                                        **self.options)
+                    accumulator.add_chunk(chunk)
+                    count = len(chunk)
+                rows += count
+                if len(data) < block_bytes:
+                    break
+
+        if accumulator.rows_per_bin.any():
+            self.latest_bin = accumulator.max_bin
+        if rows:
+            self.last_growth = time.monotonic()
+        return rows
+
+
+class TraceFollower:
+    def __init__(self, parser, time_resolution=0.001, stale_timeout=10.0):
+        """
+        Incremental parse_all_traces + create_unified_dataset for trace files
+        that are still being written
+
+        Every poll reads only the lines appended since the previous one and
+        returns the dataset rows that became final. The NR traces are written
+        in time order, so a time step is final once every trace with data has
+        gone past it. A trace that has not grown for stale_timeout seconds
+        while others do (e.g. a UE that stopped receiving) is taken as caught
+        up, so it does not hold back the other traces. The forward-fill and
+        jitter state is carried over from the last row returned, and the bins
+        already returned are dropped.
+
+        Args:
+            parser: NS3TraceParser giving the trace directory
+            time_resolution: Time step in seconds (default 1ms)
+            stale_timeout: wall time in seconds after which a trace without new
+                rows no longer holds back the others
+        """
+        self.parser = parser
+        self.time_resolution = time_resolution
+        self.stale_timeout = stale_timeout
+        aggregations = dict(AGGREGATIONS)
+        self.traces = {name: FollowedTrace(parser.trace_dir / filename,
+                                           TraceAccumulator(aggregations.get(name, []),
+                                                            time_resolution),
+                                           has_comment_header)
+                       for name, filename, has_comment_header in TRACE_FILES}
+        self.grid_start = None
+        self.next_bin = None
+        self.last_row = None
+        self.schema = None  # traces written to the dataset, fixed by the first rows returned
+        self.left_out = set()
+
+    def poll(self, final=False):
+        """
+        Read the new trace lines
+
+        Args:
+            final: the simulation has ended, return every remaining time step
+
+        Returns:
+            (rows read, DataFrame of the new dataset rows or None)
+        """
+        rows = sum(trace.read_new() for trace in self.traces.values())
+
+        started = [trace for trace in self.traces.values() if trace.latest_bin is not None]
+        if not started:
+            return rows, None
+        latest = [trace.latest_bin for trace in started]
+        now = time.monotonic()
+        active = [trace.latest_bin for trace in started
+                  if now - trace.last_growth < self.stale_timeout]
+        if self.grid_start is None:
+            self.grid_start = min(trace.accumulator.min_bin for trace in self.traces.values()
+                                  if trace.accumulator.rows_per_bin.any())
+            self.next_bin = self.grid_start
+        end_bin = max(latest) + 1 if final else min(active or latest)
+        if end_bin <= self.next_bin:
+            return rows, None
+
+        for name, trace in self.traces.items():
+            accumulator = trace.accumulator
+            late = accumulator.rows_per_bin[:max(0, self.next_bin - accumulator.base)].sum()
+            if late:
+                print(f"Warning: {late} rows of {name} arrived after their time step was written")
+
+        # Same time values as the np.arange grid of create_unified_dataset
+        min_time = self.grid_start * self.time_resolution
+        step = (min_time + self.time_resolution) - min_time
+        n_bins = end_bin - self.next_bin
+        columns = {'time': min_time + np.arange(self.next_bin - self.grid_start,
+                                                end_bin - self.grid_start) * step}
+        # Like create_unified_dataset, only the traces found get columns
+        found = [name for name, _ in AGGREGATIONS if self.traces[name].options is not None]
+        if self.schema is None:
+            self.schema = found
+        for name in found:
+            if name not in self.schema and name not in self.left_out:
+                print(f"Warning: {name} appeared after the first rows were written, left out")
+                self.left_out.add(name)
+        for name in self.schema:
+            self.traces[name].accumulator.to_grid(columns, self.next_bin, n_bins)
+        batch = pd.DataFrame(columns)
+
+        if self.last_row is not None:
+            batch = pd.concat([self.last_row, batch], ignore_index=True)
+        batch = batch.ffill().fillna(0)
+        self.last_row = batch.iloc[[-1]]
+        batch = self.parser.calculate_instantaneous_metrics(batch, self.time_resolution)
+        if len(batch) > n_bins:
+            batch = batch.iloc[1:].reset_index(drop=True)
+
+        for trace in self.traces.values():
+            trace.accumulator.discard_before(end_bin)
+        self.next_bin = end_bin
+        return rows, batch
+
+    def follow(self, poll_interval=1.0, idle_timeout=30.0):
+        """
+        Yield the new dataset rows until no trace file has grown for idle_timeout
+        seconds, then the remaining rows
+        """
+        idle = 0.0
+        while idle < idle_timeout:
+            rows, batch = self.poll()
+            if batch is not None:
+                yield batch
+            idle = 0.0 if rows else idle + poll_interval
+            time.sleep(poll_interval)
+        _, batch = self.poll(final=True)
+        if batch is not None:
+            yield batch
+
+
 if __name__ == "__main__":
+    arg_parser = argparse.ArgumentParser(description="Build the training dataset from NR trace files")
+    arg_parser.add_argument('trace_dir', nargs='?', default='~/ns-3-dev')
+    arg_parser.add_argument('--output', default='ns3_drl_training_data.csv',
+                            help="CSV file, or Parquet dataset directory if it ends in .parquet")
+    arg_parser.add_argument('--run', default=None, help="run name of the Parquet partitions")
+    arg_parser.add_argument('--resolution', type=float, default=0.001)
+    arg_parser.add_argument('--levels', default=None,
+                            help="comma-separated time steps in ms (e.g. 1,10,100) of a dataset "
+                                 "pyramid, one output per level")
+    arg_parser.add_argument('--jobs', type=int, default=None)
+    arg_parser.add_argument('--follow', action='store_true',
+                            help="append rows to the CSV while the simulation writes the traces")
+    arg_parser.add_argument('--poll-interval', type=float, default=1.0)
+    arg_parser.add_argument('--idle-timeout', type=float, default=30.0,
+                            help="stop following once no trace file grew for this many seconds")
+    arg_parser.add_argument('--stale-timeout', type=float, default=10.0,
+                            help="stop waiting for a trace file that has not grown for this many "
+                                 "seconds while others do")
+    args = arg_parser.parse_args()
+
     # Initialize parser
-    parser = NS3TraceParser("~/ns-3-dev")
+    parser = NS3TraceParser(args.trace_dir, jobs=args.jobs)
+
+    if args.follow:
+        if args.output.endswith('.parquet'):
+            arg_parser.error("--follow writes CSV output only")
+        follower = TraceFollower(parser, time_resolution=args.resolution,
+                                 stale_timeout=args.stale_timeout)
+        total = 0
+        for batch in follower.follow(args.poll_interval, args.idle_timeout):
+            batch.to_csv(args.output, mode='a' if total else 'w', header=not total, index=False)
+            total += len(batch)
+            print(f"Appended {len(batch)} rows up to {batch['time'].iloc[-1]:.6f}s ({total} total)")
+        sys.exit(0)
     
+    if args.levels:
+        resolutions = sorted(float(ms) / 1000 for ms in args.levels.split(','))
+    else:
+        resolutions = [args.resolution]
+
     # Parse all trace files
-    parser.parse_all_traces()
+    parser.parse_all_traces(time_resolution=resolutions[0])
     
-    # Create unified dataset (1ms resolution)
-    dataset = parser.create_unified_dataset(time_resolution=0.001)
+    # Create unified dataset (1ms resolution), or one per pyramid level
+    if args.levels:
+        datasets = parser.create_dataset_pyramid(resolutions)
+    else:
+        datasets = {args.resolution: parser.create_unified_dataset(time_resolution=args.resolution)}
     
-    if dataset is not None:
+    for resolution, dataset in datasets.items():
+        if dataset is None:
+            continue
+
         # Calculate instantaneous metrics (throughput, delay, jitter)
-        dataset = parser.calculate_instantaneous_metrics(dataset)
+        dataset = parser.calculate_instantaneous_metrics(dataset, resolution)
         
-        # Save to CSV
-        parser.save_dataset(dataset, 'ns3_drl_training_data.csv')
-        
\ No newline at end of file
+        # Save to CSV or Parquet, with the time step in the name of every level
+        output = Path(args.output)
+        if args.levels:
+            output = output.with_name(f"{output.stem}_{resolution * 1000:g}ms{output.suffix}")
+        if output.suffix == '.parquet':
+            parser.save_parquet(dataset, output, run=args.run, flows=resolution == resolutions[0])
+        else:
+            parser.save_dataset(dataset, output)
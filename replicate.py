@@ -0,0 +1,179 @@
+import argparse
+import math
+import os
+from concurrent.futures import ThreadPoolExecutor
+
+import pandas as pd
+
+from result_cache import ResultCache
+from sim_runner import KPIS, ScenarioRunner, parse_overrides
+
+
+# Student t quantiles (0.975) for 1..30 degrees of freedom, the same table as the
+# ConvergenceMonitor of nr-multi-slice-sim.cc
+T975 = [12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042]
+
+
+def confidence_interval(values):
+    """Return (mean, 95% CI half-width) of a list of independent replications"""
+    n = len(values)
+    mean = sum(values) / n
+    if n < 2:
+        return mean, math.inf
+    var = sum((v - mean) ** 2 for v in values) / (n - 1)
+    t = T975[n - 2] if n - 1 <= len(T975) else 1.960
+    return mean, t * math.sqrt(var / n)
+
+
+class ReplicationController:
+    def __init__(self, runner, precision=0.05, batch_size=None, min_seeds=3, max_seeds=30,
+                 first_seed=1, runs_per_process=1):
+        """
+        Run seeds of each configuration in parallel batches until the per-slice
+        KPIs reach the requested precision
+
+        Args:
+            runner: ScenarioRunner used to launch the simulations
+            precision: target 95% CI half-width, relative to the mean
+            batch_size: seeds launched per configuration and round (default: cores)
+            min_seeds: seeds run before a configuration can be declared converged
+            max_seeds: seeds after which a configuration is stopped anyway
+            first_seed: first RngRun value
+            runs_per_process: simulations run one after the other by each process
+        """
+        self.runner = runner
+        self.precision = precision
+        self.batch_size = batch_size or os.cpu_count() or 1
+        self.min_seeds = min_seeds
+        self.max_seeds = max_seeds
+        self.first_seed = first_seed
+        self.runs_per_process = runs_per_process
+
+    def is_precise(self, samples):
+        """True if every KPI of every slice meets the precision target"""
+        if len(samples) < self.min_seeds:
+            return False
+        for slice_name in samples[0]:
+            for kpi in KPIS:
+                values = [s[slice_name][kpi] for s in samples if slice_name in s]
+                mean, half_width = confidence_interval(values)
+                if half_width > self.precision * abs(mean):
+                    return False
+        return True
+
+    def run(self, configs, jobs=None):
+        """
+        Replicate all configurations, spending the seeds where variance is high
+
+        Args:
+            configs: dict name -> dict of CLI overrides
+            jobs: number of simulations running at once (default: cores)
+
+        Returns:
+            dict name -> list of per-seed KPI dicts
+        """
+        samples = {name: [] for name in configs}
+        next_seed = {name: self.first_seed for name in configs}
+        active = set(configs)
+
+        with ThreadPoolExecutor(max_workers=jobs or os.cpu_count()) as pool:
+            while active:
+                tasks = []
+                for name in sorted(active):
+                    # Failed runs count too: bound by the seeds launched so far
+                    count = min(self.batch_size,
+                                self.max_seeds - (next_seed[name] - self.first_seed))
+                    tasks += [(name, seed) for seed in range(next_seed[name], next_seed[name] + count)]
+                    next_seed[name] += count
+
+                futures = []
+                for start in range(0, len(tasks), self.runs_per_process):
+                    chunk = tasks[start:start + self.runs_per_process]
+                    futures.append((chunk, pool.submit(self.run_chunk, configs, chunk)))
+
+                for chunk, future in futures:
+                    for (name, _), kpis in zip(chunk, future.result()):
+                        if kpis:
+                            samples[name].append(kpis)
+
+                for name in sorted(active):
+                    done = self.is_precise(samples[name])
+                    if done or next_seed[name] - self.first_seed >= self.max_seeds:
+                        status = 'converged' if done else 'max seeds reached'
+                        print(f"{name}: {len(samples[name])} seeds, {status}")
+                        active.discard(name)
+
+        return samples
+
+    def run_chunk(self, configs, chunk):
+        """Run (name, seed) pairs, in a single process if there are several; return their KPIs"""
+        if len(chunk) == 1:
+            name, seed = chunk[0]
+            return [self.runner.run(configs[name], name, seed)]
+        return self.runner.run_batch([(configs[name], name, seed) for name, seed in chunk])
+
+    def summarize(self, samples):
+        """Per-configuration, per-slice mean and CI half-width of every KPI"""
+        rows = []
+        for name, runs in samples.items():
+            slices = sorted({s for run in runs for s in run})
+            for slice_name in slices:
+                for kpi in KPIS:
+                    values = [run[slice_name][kpi] for run in runs if slice_name in run]
+                    mean, half_width = confidence_interval(values)
+                    rows.append({'config': name, 'slice': slice_name, 'kpi': kpi,
+                                 'seeds': len(values), 'mean': mean, 'ci95_half_width': half_width})
+        return pd.DataFrame(rows)
+
+
+def load_configs(path):
+    """
+    Read one configuration per line as 'key=value' CLI overrides.
+    Empty lines and lines starting with '#' are ignored.
+    """
+    configs = {}
+    with open(path, 'r') as f:
+        for line in f:
+            line = line.strip()
+            if not line or line.startswith('#'):
+                continue
+            configs[f"config-{len(configs)}"] = parse_overrides(line)
+    return configs
+
+
+if __name__ == "__main__":
+    arg_parser = argparse.ArgumentParser(description="Adaptive seed replication of nr-multi-slice-sim")
+    arg_parser.add_argument('configs', help="file with one 'key=value ...' configuration per line")
+    arg_parser.add_argument('--ns3-dir', default='~/ns-3-dev')
+    arg_parser.add_argument('--config-file', default='config.txt')
+    arg_parser.add_argument('--work-dir', default='runs')
+    arg_parser.add_argument('--precision', type=float, default=0.05)
+    arg_parser.add_argument('--batch-size', type=int, default=None)
+    arg_parser.add_argument('--min-seeds', type=int, default=3)
+    arg_parser.add_argument('--max-seeds', type=int, default=30)
+    arg_parser.add_argument('--jobs', type=int, default=None)
+    arg_parser.add_argument('--runs-per-process', type=int, default=1,
+                            help="simulations run in turn by each process (batch mode)")
+    arg_parser.add_argument('--output', default='replication_summary.csv')
+    arg_parser.add_argument('--cache-dir', default=None,
+                            help="reuse results of identical runs stored in this directory")
+    arg_parser.add_argument('--cache-max-gb', type=float, default=10.0)
+    args = arg_parser.parse_args()
+
+    cache = None
+    if args.cache_dir:
+        cache = ResultCache(args.cache_dir, max_bytes=int(args.cache_max_gb * 1024 ** 3))
+    runner = ScenarioRunner(args.ns3_dir, config_file=args.config_file, work_dir=args.work_dir,
+                            cache=cache)
+    controller = ReplicationController(runner, precision=args.precision,
+                                       batch_size=args.batch_size,
+                                       min_seeds=args.min_seeds, max_seeds=args.max_seeds,
+                                       runs_per_process=args.runs_per_process)
+    samples = controller.run(load_configs(args.configs), jobs=args.jobs)
+
+    summary = controller.summarize(samples)
+    summary.to_csv(args.output, index=False)
+    print(f"\nSummary saved to: {args.output}")
+    print(summary)
@@ -0,0 +1,158 @@
+import fcntl
+import hashlib
+import json
+import os
+import shutil
+import threading
+import time
+from contextlib import contextmanager
+from pathlib import Path
+
+
+def read_config_file(path):
+    """
+    Parse config.txt the same way nr-multi-slice-sim.cc does:
+    'key=value' lines, '#' comments, any blanks around key and value stripped
+    """
+    config = {}
+    try:
+        with open(path, 'r') as f:
+            for line in f:
+                if not line.strip() or line.startswith('#'):
+                    continue
+                key, sep, value = line.partition('=')
+                if sep:
+                    config[key.strip()] = value.strip()
+    except OSError:
+        pass
+    return config
+
+
+def canonical_value(value):
+    """Normalise numbers so that '28e9', '28000000000' and '2.8e10' hash the same"""
+    text = str(value).strip()
+    try:
+        number = float(text)
+    except ValueError:
+        return text.lower() if text.lower() in ('true', 'false') else text
+    return repr(int(number)) if number.is_integer() else repr(number)
+
+
+def resolve_parameters(config_file, overrides, seed):
+    """Fully resolved parameters of a run: config.txt merged with the CLI overrides"""
+    params = read_config_file(config_file)
+    params.update(overrides)
+    params['RngRun'] = seed
+    # Output locations do not change the results
+    for key in ('outputDir', 'simTag', 'configFile'):
+        params.pop(key, None)
+    return {key: canonical_value(value) for key, value in sorted(params.items())}
+
+
+def file_digest(path, chunk_size=1 << 20):
+    """SHA-256 of a file, used as scenario binary version"""
+    digest = hashlib.sha256()
+    with open(path, 'rb') as f:
+        for chunk in iter(lambda: f.read(chunk_size), b''):
+            digest.update(chunk)
+    return digest.hexdigest()
+
+
+class ResultCache:
+    def __init__(self, cache_dir, max_bytes=10 * 1024 ** 3):
+        """
+        Content-addressed store of completed runs
+
+        Each entry is keyed by the hash of the resolved parameters and the
+        scenario binary version, and holds every file of the run directory
+        (flow report, traces, datasets). The manifest records the parameters,
+        size and last use of every entry; the least recently used entries are
+        evicted once the store exceeds max_bytes. Several processes may share
+        the store: every access holds a file lock and re-reads the manifest.
+
+        Args:
+            cache_dir: directory of the store
+            max_bytes: size bound of the stored entries
+        """
+        self.cache_dir = Path(cache_dir).expanduser().resolve()
+        self.objects_dir = self.cache_dir / 'objects'
+        self.manifest_path = self.cache_dir / 'manifest.json'
+        self.lock_path = self.cache_dir / 'lock'
+        self.max_bytes = max_bytes
+        self.lock = threading.Lock()
+
+        self.objects_dir.mkdir(parents=True, exist_ok=True)
+        self.manifest = self._load_manifest()
+
+    @staticmethod
+    def key(params, version):
+        """Hash of the canonical parameters and the binary version"""
+        blob = json.dumps({'params': params, 'version': version}, sort_keys=True)
+        return hashlib.sha256(blob.encode()).hexdigest()
+
+    def fetch(self, key, run_dir):
+        """
+        Copy a stored run into run_dir
+
+        Returns:
+            True on a hit, False otherwise
+        """
+        # Held across the copy, so that no other thread or process evicts the entry meanwhile
+        with self._locked():
+            entry = self.manifest.get(key)
+            if entry is None or not (self.objects_dir / key).is_dir():
+                return False
+            shutil.copytree(self.objects_dir / key, run_dir, dirs_exist_ok=True)
+            entry['last_used'] = time.time()
+            entry['hits'] = entry.get('hits', 0) + 1
+            self._save_manifest()
+        return True
+
+    def store(self, key, params, version, run_dir):
+        """Add a completed run directory to the store and evict old entries if needed"""
+        tmp_dir = self.objects_dir / f"{key}.tmp-{os.getpid()}-{threading.get_ident()}"
+        shutil.copytree(run_dir, tmp_dir, dirs_exist_ok=True)
+        size = sum(p.stat().st_size for p in tmp_dir.rglob('*') if p.is_file())
+
+        with self._locked():
+            target = self.objects_dir / key
+            if target.exists():
+                shutil.rmtree(tmp_dir)
+            else:
+                tmp_dir.rename(target)
+            now = time.time()
+            self.manifest[key] = {'params': params, 'version': version, 'size': size,
+                                  'created': now, 'last_used': now, 'hits': 0}
+            self._evict()
+            self._save_manifest()
+
+    def _evict(self):
+        """Drop least recently used entries until the store fits in max_bytes"""
+        total = sum(entry['size'] for entry in self.manifest.values())
+        for key in sorted(self.manifest, key=lambda k: self.manifest[k]['last_used']):
+            if total <= self.max_bytes:
+                break
+            total -= self.manifest[key]['size']
+            shutil.rmtree(self.objects_dir / key, ignore_errors=True)
+            del self.manifest[key]
+            print(f"Cache: evicted {key[:12]}")
+
+    @contextmanager
+    def _locked(self):
+        """Hold the store against other threads and processes, with the manifest re-read from disk"""
+        with self.lock, open(self.lock_path, 'a') as lock_file:
+            fcntl.flock(lock_file, fcntl.LOCK_EX)
+            self.manifest = self._load_manifest()
+            yield
+
+    def _load_manifest(self):
+        if not self.manifest_path.exists():
+            return {}
+        with open(self.manifest_path, 'r') as f:
+            return json.load(f)
+
+    def _save_manifest(self):
+        tmp_path = self.manifest_path.with_suffix('.json.tmp')
+        with open(tmp_path, 'w') as f:
+            json.dump(self.manifest, f, indent=1, sort_keys=True)
+        os.replace(tmp_path, self.manifest_path)
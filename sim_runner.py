@@ -0,0 +1,237 @@
+import hashlib
+import os
+import re
+import shutil
+import subprocess
+import tempfile
+from pathlib import Path
+
+from result_cache import file_digest, resolve_parameters
+
+# Destination port of each traffic flow, as configured in nr-multi-slice-sim.cc
+SLICE_BY_PORT = {1235: 'voice', 1234: 'video', 1236: 'gaming', 1237: 'mmtc'}
+
+# Per-slice KPIs extracted from the flow report
+KPIS = ('throughput_mbps', 'delay_ms')
+
+
+def source_digest(source):
+    """SHA-256 of a source file and of the headers it includes from its own directory"""
+    digest = hashlib.sha256(file_digest(source).encode())
+    for name in sorted(set(re.findall(r'^#include "([^"]+)"', source.read_text(), re.M))):
+        header = source.parent / name
+        if header.is_file():
+            digest.update(f"{name}:{file_digest(header)}".encode())
+    return digest.hexdigest()
+
+
+class ScenarioRunner:
+    def __init__(self, ns3_dir, program='scratch/nr-multi-slice-sim',
+                 config_file='config.txt', work_dir='runs', cache=None):
+        """
+        Launch nr-multi-slice-sim runs through the ns3 wrapper script
+
+        Args:
+            ns3_dir: ns-3 source tree containing the ns3 script (already built)
+            program: scratch program to run
+            config_file: configuration file copied into every run directory
+            work_dir: directory holding one sub-directory per run
+            cache: optional ResultCache consulted before launching a run
+        """
+        self.ns3_dir = Path(ns3_dir).expanduser().resolve()
+        self.program = program
+        self.config_file = Path(config_file).expanduser().resolve()
+        self.work_dir = Path(work_dir).expanduser().resolve()
+        self.cache = cache
+        self._version = None
+
+    def version(self):
+        """
+        Version of the scenario: digest of the built binary, or of the scratch
+        source and the local headers it includes when no binary is found
+        """
+        if self._version is None:
+            name = Path(self.program).name
+            binaries = sorted(self.ns3_dir.glob(f'build/scratch/**/*{name}*'),
+                              key=lambda p: p.stat().st_mtime)
+            binaries = [p for p in binaries if p.is_file() and os.access(p, os.X_OK)]
+            source = self.ns3_dir / f'{self.program}.cc'
+            if binaries:
+                self._version = file_digest(binaries[-1])
+            elif source.exists():
+                self._version = source_digest(source)
+            else:
+                self._version = 'unknown'
+        return self._version
+
+    def command(self, overrides, run_dir, seed):
+        """Build the command line of one run"""
+        args = [f"--{key}={value}" for key, value in overrides.items()]
+        args += [f"--RngRun={seed}", f"--outputDir={run_dir}", "--simTag=results"]
+        return [str(self.ns3_dir / 'ns3'), 'run', '--no-build', f'--cwd={run_dir}',
+                ' '.join([self.program] + args)]
+
+    def prepare(self, overrides, run_name, seed):
+        """
+        Create the directory of one run and copy the configuration file into it
+
+        Returns:
+            (run directory, cache key, resolved parameters); key and parameters
+            are None without a cache
+        """
+        run_dir = self.work_dir / run_name / f"seed-{seed}"
+        run_dir.mkdir(parents=True, exist_ok=True)
+        if self.config_file.exists():
+            shutil.copy(self.config_file, run_dir / 'config.txt')
+
+        key, params = None, None
+        if self.cache is not None:
+            params = resolve_parameters(self.config_file, overrides, seed)
+            key = self.cache.key(params, self.version())
+        return run_dir, key, params
+
+    def run(self, overrides, run_name, seed):
+        """
+        Run one simulation and return its per-slice KPIs
+
+        Every run gets its own directory, used as working directory so that the
+        NR trace files of concurrent runs do not overwrite each other.
+
+        Returns:
+            dict slice -> dict kpi -> value, or None if the run failed
+        """
+        run_dir, key, params = self.prepare(overrides, run_name, seed)
+        if key is not None and self.cache.fetch(key, run_dir):
+            print(f"Cache hit: {run_name} seed {seed}")
+            return parse_flow_report(run_dir / 'results')
+
+        with open(run_dir / 'stdout.txt', 'w') as log:
+            proc = subprocess.run(self.command(overrides, run_dir, seed), cwd=self.ns3_dir,
+                                  stdout=log, stderr=subprocess.STDOUT)
+        if proc.returncode != 0:
+            print(f"Error: {run_name} seed {seed} exited with {proc.returncode}")
+            return None
+
+        if key is not None:
+            self.cache.store(key, params, self.version(), run_dir)
+        return parse_flow_report(run_dir / 'results')
+
+    def run_batch(self, jobs):
+        """
+        Run several simulations one after the other in a single process, with
+        the --batchFile mode of nr-multi-slice-sim, to save the start-up and
+        teardown of a process per run. Each run still gets its own directory,
+        which the simulation uses as working directory. A run that ends the
+        process (fatal error, crash) fails alone: the runs after it are
+        restarted in a new batch.
+
+        Args:
+            jobs: list of (overrides, run_name, seed)
+
+        Returns:
+            list with the per-slice KPIs of every job, None for failed runs
+        """
+        results = [None] * len(jobs)
+        todo = []
+        for index, (overrides, run_name, seed) in enumerate(jobs):
+            run_dir, key, params = self.prepare(overrides, run_name, seed)
+            if key is not None and self.cache.fetch(key, run_dir):
+                print(f"Cache hit: {run_name} seed {seed}")
+                results[index] = parse_flow_report(run_dir / 'results')
+                continue
+            (run_dir / 'results').unlink(missing_ok=True)
+            args = [f"--{k}={v}" for k, v in overrides.items()]
+            args += [f"--RngRun={seed}", f"--outputDir={run_dir}", "--simTag=results",
+                     f"--configFile={run_dir / 'config.txt'}"]
+            todo.append((index, run_dir, key, params, ' '.join(args)))
+        if not todo:
+            return results
+
+        # A fatal error of one run ends the process, and with it the rest of the
+        # batch: the runs after the first one without results go in a new batch
+        pending = todo
+        while pending and self._run_batch_file([line for *_, line in pending]) != 0:
+            failed = next((i for i, job in enumerate(pending)
+                           if not (job[1] / 'results').exists()), None)
+            if failed is None:
+                break
+            _, run_name, seed = jobs[pending[failed][0]]
+            pending = [job for job in pending[failed + 1:] if not (job[1] / 'results').exists()]
+            if pending:
+                print(f"Error: {run_name} seed {seed} ended the batch, "
+                      f"restarting the {len(pending)} runs after it")
+
+        for index, run_dir, key, params, _ in todo:
+            if not (run_dir / 'results').exists():
+                _, run_name, seed = jobs[index]
+                print(f"Error: {run_name} seed {seed} wrote no results")
+                continue
+            if key is not None:
+                self.cache.store(key, params, self.version(), run_dir)
+            results[index] = parse_flow_report(run_dir / 'results')
+        return results
+
+    def _run_batch_file(self, lines):
+        """Run the command lines in one --batchFile process; returns its exit status"""
+        self.work_dir.mkdir(parents=True, exist_ok=True)
+        with tempfile.NamedTemporaryFile('w', dir=self.work_dir, prefix='batch-', suffix='.txt',
+                                         delete=False) as batch:
+            batch.write('\n'.join(lines) + '\n')
+        batch_file = Path(batch.name)
+        log_file = batch_file.with_suffix('.log')
+        command = [str(self.ns3_dir / 'ns3'), 'run', '--no-build', f'--cwd={self.work_dir}',
+                   f'{self.program} --batchFile={batch_file}']
+        with open(log_file, 'w') as log:
+            proc = subprocess.run(command, cwd=self.ns3_dir, stdout=log, stderr=subprocess.STDOUT)
+        if proc.returncode != 0:
+            print(f"Error: batch {batch_file.name} exited with {proc.returncode}, see {log_file}")
+        batch_file.unlink()
+        return proc.returncode
+
+
+def parse_flow_report(path):
+    """
+    Aggregate the per-flow report written by nr-multi-slice-sim into per-slice KPIs
+
+    Slice throughput is the sum of its flow throughputs; slice delay is the
+    mean flow delay weighted by the received packets.
+    """
+    flow_re = re.compile(r'^Flow \d+ \(\S+:\d+ -> \S+:(\d+)\)')
+    value_re = re.compile(r'^\s+(Throughput|Mean delay|Rx Packets):\s+([-+0-9.eE]+)')
+
+    slices = {}
+    current = None
+    try:
+        with open(path, 'r') as f:
+            for line in f:
+                match = flow_re.match(line)
+                if match:
+                    current = {'port': int(match.group(1))}
+                    slice_name = SLICE_BY_PORT.get(current['port'], 'other')
+                    slices.setdefault(slice_name, []).append(current)
+                    continue
+                match = value_re.match(line)
+                if match and current is not None:
+                    current[match.group(1)] = float(match.group(2))
+    except OSError as e:
+        print(f"Error: {path}: {e}")
+        return None
+
+    kpis = {}
+    for slice_name, flows in slices.items():
+        rx_packets = sum(flow.get('Rx Packets', 0) for flow in flows)
+        delay_sum = sum(flow.get('Mean delay', 0) * flow.get('Rx Packets', 0) for flow in flows)
+        kpis[slice_name] = {
+            'throughput_mbps': sum(flow.get('Throughput', 0) for flow in flows),
+            'delay_ms': delay_sum / rx_packets if rx_packets > 0 else 0.0,
+        }
+    return kpis
+
+
+def parse_overrides(line):
+    """Parse a 'key=value key=value ...' line into an ordered dict of CLI overrides"""
+    overrides = {}
+    for token in line.split():
+        key, _, value = token.partition('=')
+        overrides[key.lstrip('-')] = value
+    return overrides
@@ -0,0 +1,171 @@
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import textwrap
+import unittest
+from pathlib import Path
+
+from result_cache import read_config_file
+from sim_runner import ScenarioRunner
+
+# Built ns-3 tree holding scratch/nr-multi-slice-sim, e.g. NS3_DIR=~/ns-3-dev
+NS3_DIR = Path(os.environ.get('NS3_DIR', '~/ns-3-dev')).expanduser()
+
+# C++ compiler for the checks of nr-batch-file.h, which need no ns-3
+CXX = shutil.which(os.environ.get('CXX', 'g++'))
+
+# Prints the runs of the batch file argv[1], read from the current directory
+BATCH_FILE_DRIVER = r"""
+#include "nr-batch-file.h"
+
+#include <fstream>
+#include <iostream>
+
+int
+main(int argc, char* argv[])
+{
+    std::ifstream batch(argv[1]);
+    for (const BatchRun& run : ReadBatchFile(batch, "sim", std::filesystem::current_path()))
+    {
+        std::cout << run.index << '\t' << run.runDir.string();
+        for (const std::string& arg : run.args)
+        {
+            std::cout << '\t' << arg;
+        }
+        std::cout << '\n';
+    }
+}
+"""
+
+# Stand-in for the ns3 script: runs a --batchFile like nr-multi-slice-sim, and
+# ends the process at a line with --abort=1, like a fatal error
+FAKE_NS3 = textwrap.dedent("""\
+    import sys
+    from pathlib import Path
+
+    batch_file = sys.argv[-1].split('--batchFile=')[1]
+    for line in Path(batch_file).read_text().splitlines():
+        args = dict(arg.lstrip('-').partition('=')[::2] for arg in line.split())
+        if args.get('abort') == '1':
+            sys.exit(134)
+        Path(args['outputDir'], 'results').write_text(
+            "Flow 1 (1.0.0.2:49153 -> 7.0.0.2:1234)\\n"
+            f"  Throughput: {args['RngRun']}\\n  Mean delay: 2\\n  Rx Packets: 10\\n")
+""")
+
+
+@unittest.skipUnless(CXX, "no C++ compiler (set CXX)")
+class BatchFileTest(unittest.TestCase):
+    """Command lines that main() builds from a batch file, without ns-3"""
+
+    @classmethod
+    def setUpClass(cls):
+        cls.tmp = tempfile.TemporaryDirectory()
+        cls.build_dir = Path(cls.tmp.name)
+        source = cls.build_dir / 'driver.cc'
+        source.write_text(BATCH_FILE_DRIVER)
+        cls.driver = cls.build_dir / 'driver'
+        subprocess.run([CXX, '-std=c++17', f'-I{Path(__file__).parent}', str(source),
+                        '-o', str(cls.driver)], check=True)
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.tmp.cleanup()
+
+    def read_batch(self, text):
+        """Runs of a batch file, as (index, run directory, arguments)"""
+        batch_dir = self.build_dir / 'batch'
+        batch_dir.mkdir(exist_ok=True)
+        (batch_dir / 'batch.txt').write_text(text)
+        out = subprocess.run([str(self.driver), 'batch.txt'], cwd=batch_dir, check=True,
+                             capture_output=True, text=True).stdout
+        runs = []
+        for line in out.splitlines():
+            index, run_dir, *args = line.split('\t')
+            runs.append((int(index), Path(run_dir), args))
+        return batch_dir, runs
+
+    def test_comments_and_blank_lines(self):
+        """Only scenario lines are runs, numbered from 0"""
+        batch_dir, runs = self.read_batch("# header\n\n--RngRun=1\n   \n  # off\n--RngRun=2\n")
+        self.assertEqual([index for index, *_ in runs], [0, 1])
+        self.assertEqual([args[1] for *_, args in runs], ['--RngRun=1', '--RngRun=2'])
+        self.assertEqual(runs[1][1], batch_dir / 'run-1')
+
+    def test_defaults(self):
+        """A bare line runs in run-<n> with config.txt of the batch directory and tag results"""
+        batch_dir, runs = self.read_batch("--RngRun=1\n")
+        self.assertEqual(runs, [(0, batch_dir / 'run-0',
+                                 ['sim', '--RngRun=1', f"--configFile={batch_dir / 'config.txt'}",
+                                  '--outputDir=.', '--simTag=results'])])
+
+    def test_paths_relative_to_batch_directory(self):
+        """outputDir, configFile and blerTableFile are taken from the batch directory"""
+        batch_dir, runs = self.read_batch(
+            "--outputDir=runs/a --configFile=cfg/urllc.txt --blerTableFile=bler.bin "
+            "--simTag=x\n--configFile=/etc/absolute.txt\n")
+        self.assertEqual(runs[0][1], batch_dir / 'runs/a')
+        self.assertEqual(runs[0][2], ['sim', f"--blerTableFile={batch_dir / 'bler.bin'}",
+                                      '--simTag=x', f"--configFile={batch_dir / 'cfg/urllc.txt'}",
+                                      '--outputDir=.'])
+        self.assertIn('--configFile=/etc/absolute.txt', runs[1][2])
+
+
+class RunBatchTest(unittest.TestCase):
+    """ScenarioRunner.run_batch against a stand-in for the ns3 script"""
+
+    def setUp(self):
+        self.tmp = tempfile.TemporaryDirectory()
+        self.ns3_dir = Path(self.tmp.name)
+        ns3 = self.ns3_dir / 'ns3'
+        ns3.write_text(f"#!{sys.executable}\n" + FAKE_NS3)
+        ns3.chmod(0o755)
+
+    def tearDown(self):
+        self.tmp.cleanup()
+
+    def test_aborted_run_fails_alone(self):
+        """The runs after one that ends the process still get their results"""
+        runner = ScenarioRunner(self.ns3_dir, config_file=self.ns3_dir / 'none.txt',
+                                work_dir=self.ns3_dir / 'runs')
+        jobs = [({}, 'a', 1), ({'abort': 1}, 'b', 2), ({}, 'c', 3), ({'abort': 1}, 'd', 4)]
+        results = runner.run_batch(jobs)
+        self.assertEqual([r and r['video']['throughput_mbps'] for r in results],
+                         [1, None, 3, None])
+
+
+@unittest.skipUnless((NS3_DIR / 'ns3').exists(), f"no ns-3 tree at {NS3_DIR} (set NS3_DIR)")
+class BatchModeTest(unittest.TestCase):
+    def setUp(self):
+        self.tmp = tempfile.TemporaryDirectory()
+        self.work_dir = Path(self.tmp.name)
+
+    def tearDown(self):
+        self.tmp.cleanup()
+
+    def write_config(self, name, **changes):
+        """config.txt of the repository with some keys changed"""
+        config = read_config_file(Path(__file__).parent / 'config.txt')
+        config.update({key: str(value) for key, value in changes.items()})
+        path = self.work_dir / name
+        path.write_text(''.join(f"{key}={value}\n" for key, value in config.items()))
+        return path
+
+    def test_batch_uses_config_file(self):
+        """A batch run reads its own configuration file, like a single run does"""
+        short = self.write_config('short.txt', simTimeMs=600, ueNum=2)
+        default = self.write_config('default.txt', simTimeMs=600)
+        runner = ScenarioRunner(NS3_DIR, config_file=short, work_dir=self.work_dir / 'short')
+        single = runner.run({}, 'single', 1)
+        batch = runner.run_batch([({}, 'batch', 1)])[0]
+        self.assertIsNotNone(single)
+        self.assertEqual(batch, single)
+
+        runner = ScenarioRunner(NS3_DIR, config_file=default, work_dir=self.work_dir / 'default')
+        self.assertNotEqual(runner.run_batch([({}, 'batch', 1)])[0], batch)
+
+
+if __name__ == '__main__':
+    unittest.main()